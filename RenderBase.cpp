@@ -3,10 +3,43 @@
 #include "vector"
 #include "iostream"
 #include "fstream"
+#include "chrono"
+#include "algorithm"
+#include "climits"
+#include "cstdlib"
 
 #define VOLK_IMPLEMENTATION
 #include "volk/volk.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include "windows.h"
+#else
+#include "sys/mman.h"
+#include "sys/stat.h"
+#include "fcntl.h"
+#include "unistd.h"
+#endif
+
+//sse2 is baseline on every x64 target, other targets use the scalar paths
+#if defined(__SSE2__) || defined(_M_X64)
+#define RENDER_SSE2
+#include "emmintrin.h"
+#endif
+
+//FNV-1a, used wherever state has to be turned into a cache key
+uint64_t hashBytes(uint64_t hash, const void * data, size_t size){
+    const unsigned char * bytes = static_cast<const unsigned char *>(data);
+    for(size_t i = 0; i < size; i++){
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static const uint64_t HASH_SEED = 14695981039346656037ull;
+
 std::vector<char> readFile(const std::string& filename){
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
@@ -85,6 +118,28 @@ void PipelineBuilder::setVertexInputState(){
     this->vertexInputState.pVertexAttributeDescriptions = (*attributeDescriptions).data();
 }
 
+void PipelineBuilder::setInstancedVertexInputState(){
+    //VERTEX INPUT STATE, per vertex and per instance streams
+    auto bindingDescription = Vertex::getBindingDescription();
+    auto attributeDescriptions = Vertex::getAttributeDescriptions();
+
+    this->vertexBindings = {*bindingDescription, InstanceData::getBindingDescription()};
+    this->vertexAttributes = *attributeDescriptions;
+    for(auto & attribute : InstanceData::getAttributeDescriptions()){
+        this->vertexAttributes.push_back(attribute);
+    }
+    delete bindingDescription;
+    delete attributeDescriptions;
+
+    this->vertexInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    this->vertexInputState.pNext = nullptr;
+    this->vertexInputState.flags = 0;
+    this->vertexInputState.vertexBindingDescriptionCount = static_cast<uint32_t>(this->vertexBindings.size());
+    this->vertexInputState.pVertexBindingDescriptions = this->vertexBindings.data();
+    this->vertexInputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(this->vertexAttributes.size());
+    this->vertexInputState.pVertexAttributeDescriptions = this->vertexAttributes.data();
+}
+
 void PipelineBuilder::setTessellationState(){
     //TESSELATION STATE
     VkPipelineTessellationStateCreateInfo tessellationCI = {
@@ -178,27 +233,57 @@ void PipelineBuilder::setColorblendState(){
     this->colorblendState = colorBlendCI;
 }
 
+void PipelineBuilder::addDescriptorSetLayout(VkDescriptorSetLayout setLayout){
+    //set numbers follow the order layouts are added in
+    this->descriptorSetLayouts.push_back(setLayout);
+}
+
 void PipelineBuilder::setPipelineLayout(Context & context){
     //GRAPHICS PIPELINE AND LAYOUT
     VkPipelineLayoutCreateInfo pipelineLayoutCI = {
         VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,                  //sType
         nullptr,                                                        //pNext
         0,                                                              //flags
-        0,                                                              //setLayoutCount
-        nullptr,                                                        //pSetLayouts
-        0,                                                              //pushConstantRangeCount
-        nullptr                                                         //pPushConstantRanges
+        static_cast<uint32_t>(this->descriptorSetLayouts.size()),       //setLayoutCount
+        this->descriptorSetLayouts.data(),                              //pSetLayouts
+        static_cast<uint32_t>(this->pushConstantRanges.size()),         //pushConstantRangeCount
+        this->pushConstantRanges.data()                                 //pPushConstantRanges
     };
 
+    for(auto & range : this->pushConstantRanges){
+        if(range.offset + range.size > context.properties.limits.maxPushConstantsSize){
+            std::cout << "push constant range exceeds device limit" << std::endl;
+            exit(1);
+        }
+    }
+
     if(vkCreatePipelineLayout(context.device, &pipelineLayoutCI, nullptr, &this->pipelineLayout) != VK_SUCCESS){
         std::cout << "could not create pipeline layout" << std::endl;
         exit(1);
     }
 }
 
+void PipelineBuilder::setPipelineLayout(VkPipelineLayout pipelineLayout){
+    //share a layout that was already created instead of making a new one
+    this->pipelineLayout = pipelineLayout;
+}
+
 VkPipeline & PipelineBuilder::createPipeline(Context & context, RenderPass & renderPass){
-    std::cout << "=" << std::endl;
-    std::cout << this->vertexInputState.pVertexAttributeDescriptions->binding << std::endl;
+    return this->createPipeline(context, renderPass, nullptr);
+}
+
+VkPipeline & PipelineBuilder::createPipeline(Context & context, RenderPass & renderPass, VkPipelineCache pipelineCache){
+    //viewport and scissor follow the swapchain, so a resize needs no new
+    //pipelines
+    VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    VkPipelineDynamicStateCreateInfo dynamicState = {
+        VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,   //sType
+        nullptr,                                                //pNext
+        0,                                                      //flags
+        2,                                                      //dynamicStateCount
+        dynamicStates                                           //pDynamicStates
+    };
+
     VkGraphicsPipelineCreateInfo graphicsPipelineCI = {
         VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,        //sType 
         nullptr,                                                //pNext
@@ -213,7 +298,7 @@ VkPipeline & PipelineBuilder::createPipeline(Context & context, RenderPass & ren
         &this->multisampleState,                                         //pMultisampleState
         nullptr,                                                //pDepthStencilState
         &this->colorblendState,                                          //pColorBlendState
-        nullptr,                                                //pDynamicState
+        &dynamicState,                                          //pDynamicState
         this->pipelineLayout,                                         //layout
         renderPass.renderPass,                                            //renderPass
         0,                                                      //subpass
@@ -221,7 +306,7 @@ VkPipeline & PipelineBuilder::createPipeline(Context & context, RenderPass & ren
         {}                                                      //basePipelineIndex
     };
 
-    if(vkCreateGraphicsPipelines(context.device, nullptr, 1, &graphicsPipelineCI, nullptr, &this->pipeline) != VK_SUCCESS){
+    if(vkCreateGraphicsPipelines(context.device, pipelineCache, 1, &graphicsPipelineCI, nullptr, &this->pipeline) != VK_SUCCESS){
         std::cout << "could not create pipeline" << std::endl;
         exit(1);
     }
@@ -229,6 +314,33 @@ VkPipeline & PipelineBuilder::createPipeline(Context & context, RenderPass & ren
     return this->pipeline;
 }
 
+VkPipeline & PipelineBuilder::createComputePipeline(Context & context){
+    VkComputePipelineCreateInfo computePipelineCI = {
+        VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,         //sType
+        nullptr,                                                //pNext
+        0,                                                      //flags
+        this->shaderStages[0],                                  //stage
+        this->pipelineLayout,                                   //layout
+        VK_NULL_HANDLE,                                         //basePipelineHandle
+        -1                                                      //basePipelineIndex
+    };
+
+    if(vkCreateComputePipelines(context.device, VK_NULL_HANDLE, 1, &computePipelineCI, nullptr, &this->pipeline) != VK_SUCCESS){
+        std::cout << "could not create compute pipeline" << std::endl;
+        exit(1);
+    }
+
+    return this->pipeline;
+}
+
+void PipelineBuilder::releaseShaderModules(Context & context){
+    //modules are only needed until the pipeline is created
+    for(auto & shaderStage : this->shaderStages){
+        vkDestroyShaderModule(context.device, shaderStage.module, nullptr);
+    }
+    this->shaderStages.clear();
+}
+
 //=====================================================================
 //===============================CONTEXT===============================
 //=====================================================================
@@ -238,13 +350,37 @@ void Context::createInstance(){
     if(volkInitialize() != VK_SUCCESS){
         return;
     } 
-    //init sdl
-    SDL_Init(SDL_INIT_VIDEO);
-    SDL_Vulkan_LoadLibrary(nullptr);
-
-    //get needed instance extensions required by sdl
-    uint32_t sdlExtensions = 0;
-    const char * const *extensions = SDL_Vulkan_GetInstanceExtensions(&sdlExtensions);
+    std::vector<const char *> instanceExtensions;
+    if(this->headless){
+        //no window system at all, a headless surface is used if the loader
+        //offers one and offscreen images otherwise
+        uint32_t extensionCount = 0;
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> available(extensionCount);
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, available.data());
+
+        bool surface = false;
+        bool headlessSurface = false;
+        for(auto & extension : available){
+            surface = surface || strcmp(extension.extensionName, "VK_KHR_surface") == 0;
+            headlessSurface = headlessSurface || strcmp(extension.extensionName, "VK_EXT_headless_surface") == 0;
+        }
+        this->headlessSurfaceSupported = surface && headlessSurface;
+        if(this->headlessSurfaceSupported){
+            instanceExtensions.push_back("VK_KHR_surface");
+            instanceExtensions.push_back("VK_EXT_headless_surface");
+        }
+    }
+    else{
+        //init sdl
+        SDL_Init(SDL_INIT_VIDEO);
+        SDL_Vulkan_LoadLibrary(nullptr);
+
+        //get needed instance extensions required by sdl
+        uint32_t sdlExtensions = 0;
+        const char * const *extensions = SDL_Vulkan_GetInstanceExtensions(&sdlExtensions);
+        instanceExtensions.assign(extensions, extensions + sdlExtensions);
+    }
 
     VkApplicationInfo app_info = {
         VK_STRUCTURE_TYPE_APPLICATION_INFO,             //sType
@@ -263,8 +399,8 @@ void Context::createInstance(){
         &app_info,                                      //pApplicationInfo
         0,                                              //enabledLayerCount
         nullptr,                                        //ppEnabledLayerNames
-        sdlExtensions,                                  //enabledExtensionCount
-        extensions                                      //ppEnabledExtensionNames
+        static_cast<uint32_t>(instanceExtensions.size()), //enabledExtensionCount
+        instanceExtensions.data()                       //ppEnabledExtensionNames
     };
 
     //create instance
@@ -291,17 +427,44 @@ void Context::createPhysicalDevice(){
         exit(1);
     }
 
-    //pick discrete gpu
+    if(deviceCount == 0){
+        std::cout << "no vulkan devices found" << std::endl;
+        exit(1);
+    }
+
+    //prefer a discrete gpu, then integrated and virtual ones, and fall back
+    //to a cpu implementation like lavapipe on machines without a gpu
+    auto deviceRank = [](VkPhysicalDeviceType type){
+        switch(type){
+            case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return 4;
+            case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return 3;
+            case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return 2;
+            case VK_PHYSICAL_DEVICE_TYPE_CPU: return 1;
+            default: return 0;
+        }
+    };
+    int bestRank = -1;
     VkPhysicalDeviceProperties deviceProperties = {};
     for(auto device : queried_devices){
         vkGetPhysicalDeviceProperties(device, &deviceProperties);
-        if(deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU){
+        //everything here is written against 1.3
+        if(deviceProperties.apiVersion < VK_API_VERSION_1_3){
+            continue;
+        }
+        int rank = deviceRank(deviceProperties.deviceType);
+        if(rank > bestRank){
             this->physicalDevice = device;
-            break;
+            bestRank = rank;
         }
     }
+    if(bestRank < 0){
+        std::cout << "no vulkan 1.3 device found" << std::endl;
+        exit(1);
+    }
 
-    
+    //keep the limits around, anything sized against the device reads them
+    vkGetPhysicalDeviceProperties(this->physicalDevice, &this->properties);
+    std::cout << "using " << this->properties.deviceName << std::endl;
 }
 
 void Context::createLogicalDeviceAndQueue(){
@@ -311,45 +474,170 @@ void Context::createLogicalDeviceAndQueue(){
     std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
     vkGetPhysicalDeviceQueueFamilyProperties(this->physicalDevice, &queueFamilyCount, queueFamilyProperties.data());
 
-    //find graphics and transfer queue
-    int i = 0;
-    for(auto queueFamily : queueFamilyProperties){
-        if(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT & VK_QUEUE_TRANSFER_BIT != 0){
+    //find graphics queue, graphics families always support transfer too
+    bool graphicsFound = false;
+    for(uint32_t i = 0; i < queueFamilyCount; i++){
+        if(queueFamilyProperties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT){
             this->queue.queueFamilyIndex = i;
-            this->queue.queueCount = queueFamily.queueCount;
+            this->queue.queueCount = queueFamilyProperties[i].queueCount;
+            graphicsFound = true;
+            break;
         }
-        i++;
+    }
+    if(!graphicsFound){
+        std::cout << "could not find a graphics queue" << std::endl;
+        exit(1);
     }
 
-    //queue create infos
-    std::vector<float> priorities(this->queue.queueCount);
-    for(auto priority : priorities){
-        priority = 1.0f;
+    //find compute queue, a family without graphics overlaps best, a second
+    //queue in the graphics family is next, otherwise share the graphics queue
+    uint32_t computeFamily = this->queue.queueFamilyIndex;
+    uint32_t computeIndex = 0;
+    if(!this->forceSingleQueue){
+        bool dedicated = false;
+        for(uint32_t i = 0; i < queueFamilyCount; i++){
+            VkQueueFlags flags = queueFamilyProperties[i].queueFlags;
+            if((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)){
+                computeFamily = i;
+                dedicated = true;
+                break;
+            }
+        }
+        if(!dedicated && this->queue.queueCount > 1){
+            computeIndex = 1;
+        }
+    }
+    this->computeQueue.queueFamilyIndex = computeFamily;
+    this->computeQueue.queueCount = queueFamilyProperties[computeFamily].queueCount;
+    this->asyncComputeSupported = computeFamily != this->queue.queueFamilyIndex || computeIndex != 0;
+
+    //queue create infos, only the queues actually used, all at full priority
+    std::vector<float> priorities(2, 1.0f);
+    std::vector<VkDeviceQueueCreateInfo> queueCIs;
+    queueCIs.push_back({
+        VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,     //sType
+        nullptr,                                        //pNext
+        0,                                              //flags
+        this->queue.queueFamilyIndex,                   //queueFamilyIndex
+        computeFamily == this->queue.queueFamilyIndex ? computeIndex + 1 : 1, //queueCount
+        priorities.data()                               //pQueuePriorities
+    });
+    if(computeFamily != this->queue.queueFamilyIndex){
+        queueCIs.push_back({
+            VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO, //sType
+            nullptr,                                    //pNext
+            0,                                          //flags
+            computeFamily,                              //queueFamilyIndex
+            1,                                          //queueCount
+            priorities.data()                           //pQueuePriorities
+        });
     }
-    VkDeviceQueueCreateInfo queueCI = {
-        VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-        nullptr,
-        0,
-        this->queue.queueFamilyIndex,
-        this->queue.queueCount,
-        priorities.data()
-    };
 
-    std::vector<const char*> deviceExtensions = {
-        "VK_KHR_swapchain"
-    };
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(this->physicalDevice, nullptr, &extensionCount, nullptr);
+    this->availableDeviceExtensions.resize(extensionCount);
+    vkEnumerateDeviceExtensionProperties(this->physicalDevice, nullptr, &extensionCount, this->availableDeviceExtensions.data());
+
+    //offscreen rendering works without a swapchain, a window does not
+    std::vector<const char*> deviceExtensions;
+    this->swapchainSupported = this->hasDeviceExtension("VK_KHR_swapchain");
+    if(this->swapchainSupported){
+        deviceExtensions.push_back("VK_KHR_swapchain");
+    }
+    else if(!this->headless){
+        std::cout << "device does not support swapchains" << std::endl;
+        exit(1);
+    }
+
+    //query what the device can do, then enable only the bits we use
+    VkPhysicalDeviceHostImageCopyFeaturesEXT supportedHostImageCopy = {};
+    supportedHostImageCopy.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT;
+    VkPhysicalDeviceVulkan13Features supported13 = {};
+    supported13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+    VkPhysicalDeviceVulkan12Features supported12 = {};
+    supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    supported12.pNext = &supported13;
+    bool hostImageCopyExtension = this->hasDeviceExtension("VK_EXT_host_image_copy");
+    if(hostImageCopyExtension){
+        supported13.pNext = &supportedHostImageCopy;
+    }
+    VkPhysicalDeviceFeatures2 supportedFeatures = {};
+    supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    supportedFeatures.pNext = &supported12;
+    vkGetPhysicalDeviceFeatures2(this->physicalDevice, &supportedFeatures);
+
+    this->features12 = {};
+    this->features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+    //all queue synchronization runs on timelines
+    if(!supported12.timelineSemaphore){
+        std::cout << "device does not support timeline semaphores" << std::endl;
+        exit(1);
+    }
+    this->features12.timelineSemaphore = VK_TRUE;
+
+    //queue submits and barriers go through synchronization2
+    this->features13 = {};
+    this->features13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+    if(!supported13.synchronization2){
+        std::cout << "device does not support synchronization2" << std::endl;
+        exit(1);
+    }
+    this->features13.synchronization2 = VK_TRUE;
+    //render graph passes begin rendering on their own attachments
+    this->features13.dynamicRendering = supported13.dynamicRendering;
+    this->features12.pNext = &this->features13;
+
+    //block compressed sampling for ktx2 textures
+    this->features = {};
+    this->features.textureCompressionBC = supportedFeatures.features.textureCompressionBC;
+    this->features.textureCompressionASTC_LDR = supportedFeatures.features.textureCompressionASTC_LDR;
+
+    //gpu driven drawing, commands written by compute and counted on the gpu
+    this->features.multiDrawIndirect = supportedFeatures.features.multiDrawIndirect;
+    this->features.drawIndirectFirstInstance = supportedFeatures.features.drawIndirectFirstInstance;
+    this->features12.drawIndirectCount = supported12.drawIndirectCount;
+
+    //descriptor indexing for the bindless table
+    this->bindlessSupported = supported12.descriptorIndexing &&
+                              supported12.runtimeDescriptorArray &&
+                              supported12.descriptorBindingPartiallyBound &&
+                              supported12.descriptorBindingVariableDescriptorCount &&
+                              supported12.descriptorBindingSampledImageUpdateAfterBind &&
+                              supported12.descriptorBindingStorageBufferUpdateAfterBind &&
+                              supported12.shaderSampledImageArrayNonUniformIndexing;
+    if(this->bindlessSupported){
+        this->features12.descriptorIndexing = VK_TRUE;
+        this->features12.runtimeDescriptorArray = VK_TRUE;
+        this->features12.descriptorBindingPartiallyBound = VK_TRUE;
+        this->features12.descriptorBindingVariableDescriptorCount = VK_TRUE;
+        this->features12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        this->features12.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+        this->features12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        this->features12.shaderStorageBufferArrayNonUniformIndexing = supported12.shaderStorageBufferArrayNonUniformIndexing;
+    }
+
+    //host image copy for texture streaming without staging buffers
+    this->hostImageCopyFeatures = {};
+    this->hostImageCopyFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT;
+    this->hostImageCopySupported = hostImageCopyExtension && supportedHostImageCopy.hostImageCopy;
+    if(this->hostImageCopySupported){
+        this->hostImageCopyFeatures.hostImageCopy = VK_TRUE;
+        this->features13.pNext = &this->hostImageCopyFeatures;
+        deviceExtensions.push_back("VK_EXT_host_image_copy");
+    }
 
     VkDeviceCreateInfo deviceCI = {
         VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,           //sType
-        nullptr,                                        //pNext
+        &this->features12,                              //pNext
         0,                                              //flags
-        1,                                              //queueCreateInfoCount
-        &queueCI,                                       //pQueueCreateInfos
+        static_cast<uint32_t>(queueCIs.size()),         //queueCreateInfoCount
+        queueCIs.data(),                                //pQueueCreateInfos
         0,                                              //enabledLayerCount
         nullptr,                                        //ppEnabledLayerNames
-        1,                                              //enabledExtensionCount
+        static_cast<uint32_t>(deviceExtensions.size()), //enabledExtensionCount
         deviceExtensions.data(),                        //ppEnabledExtensionNames
-        nullptr                                         //pEnabledFeatures
+        &this->features                                 //pEnabledFeatures
     };
 
     //create device
@@ -358,8 +646,109 @@ void Context::createLogicalDeviceAndQueue(){
         exit(1);
     }
 
-    //grab queue handle
+    //grab queue handles
     vkGetDeviceQueue(this->device, this->queue.queueFamilyIndex, 0, &this->queue.queueFamily);
+    vkGetDeviceQueue(this->device, computeFamily, computeIndex, &this->computeQueue.queueFamily);
+
+    this->createTimelines();
+}
+
+void Context::createTimelines(){
+    //a shared queue still gets its own compute timeline, the tokens stay
+    //meaningful either way
+    this->timelines.resize(2);
+    this->timelines[GRAPHICS_TIMELINE].queue = this->queue.queueFamily;
+    this->timelines[COMPUTE_TIMELINE].queue = this->computeQueue.queueFamily;
+    for(auto & timeline : this->timelines){
+        VkSemaphoreTypeCreateInfo semaphoreTypeCI = {
+            VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,   //sType
+            nullptr,                                        //pNext
+            VK_SEMAPHORE_TYPE_TIMELINE,                     //semaphoreType
+            0                                               //initialValue
+        };
+
+        VkSemaphoreCreateInfo semaphoreCI = {
+            VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,        //sType
+            &semaphoreTypeCI,                               //pNext
+            0                                               //flags
+        };
+
+        if(vkCreateSemaphore(this->device, &semaphoreCI, nullptr, &timeline.semaphore) != VK_SUCCESS){
+            std::cout << "could not create timeline semaphore" << std::endl;
+            exit(1);
+        }
+        timeline.submitted = 0;
+        timeline.completed = 0;
+    }
+}
+
+SyncToken Context::nextToken(uint32_t queue){
+    return {queue, ++this->timelines[queue].submitted};
+}
+
+SyncToken Context::lastSubmitted(uint32_t queue){
+    return {queue, this->timelines[queue].submitted};
+}
+
+VkSemaphore Context::getTimeline(uint32_t queue){
+    return this->timelines[queue].semaphore;
+}
+
+VkQueue Context::getQueue(uint32_t queue){
+    return this->timelines[queue].queue;
+}
+
+bool Context::isComplete(const SyncToken & token){
+    QueueTimeline & timeline = this->timelines[token.queue];
+    if(token.value <= timeline.completed){
+        return true;
+    }
+    vkGetSemaphoreCounterValue(this->device, timeline.semaphore, &timeline.completed);
+    return token.value <= timeline.completed;
+}
+
+void Context::wait(const SyncToken & token){
+    if(this->isComplete(token)){
+        return;
+    }
+
+    QueueTimeline & timeline = this->timelines[token.queue];
+    VkSemaphoreWaitInfo waitInfo = {
+        VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,              //sType
+        nullptr,                                            //pNext
+        0,                                                  //flags
+        1,                                                  //semaphoreCount
+        &timeline.semaphore,                                //pSemaphores
+        &token.value                                        //pValues
+    };
+
+    if(vkWaitSemaphores(this->device, &waitInfo, UINT64_MAX) != VK_SUCCESS){
+        std::cout << "could not wait on timeline semaphore" << std::endl;
+        exit(1);
+    }
+    timeline.completed = std::max(timeline.completed, token.value);
+}
+
+bool Context::hasDeviceExtension(const char * name){
+    for(auto & extension : this->availableDeviceExtensions){
+        if(strcmp(extension.extensionName, name) == 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t Context::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties){
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(this->physicalDevice, &memProperties);
+
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("failed to find suitable memory type!");
 }
 
 void Context::initContext(){
@@ -371,67 +760,121 @@ void Context::initContext(){
 //=====================================================================
 //===============================DISPLAY===============================
 //=====================================================================
+static const char * presentModeName(VkPresentModeKHR presentMode){
+    switch(presentMode){
+        case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+        case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+        case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo relaxed";
+        default: return "other";
+    }
+}
+
+static const char * presentPolicyName(PresentPolicy policy){
+    switch(policy){
+        case PRESENT_LOWEST_LATENCY: return "lowest latency";
+        case PRESENT_SMOOTH: return "smooth";
+        case PRESENT_POWER_SAVER: return "power saver";
+    }
+    return "unknown";
+}
+
+static uint64_t steadyNanoseconds(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 void Display::createWindowAndSurface(Context & context, int width, int height){
-    this->window = SDL_CreateWindow("hello", width, height, SDL_WINDOW_VULKAN);
+    this->window = SDL_CreateWindow("hello", width, height, SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
     if(false == SDL_Vulkan_CreateSurface(this->window, context.instance, nullptr, &this->surface)){
         std::cout << SDL_GetError() << std::endl;
     }
 }
 
-void Display::createSwapchain(Context & context){
+bool Display::createSwapchain(Context & context){
     //query surface capabilities for current extent of surface
     VkSurfaceCapabilitiesKHR surfaceCapabilities = {};
     vkGetPhysicalDeviceSurfaceCapabilitiesKHR(context.physicalDevice, this->surface, &surfaceCapabilities);
 
-    uint32_t presentModeCount = 0;
-    vkGetPhysicalDeviceSurfacePresentModesKHR(context.physicalDevice, this->surface, &presentModeCount,nullptr);
-    std::vector<VkPresentModeKHR> presentModes(presentModeCount);
-    vkGetPhysicalDeviceSurfacePresentModesKHR(context.physicalDevice, this->surface, &presentModeCount,presentModes.data());
-
     uint32_t surfaceFormatCount = 0;
     vkGetPhysicalDeviceSurfaceFormatsKHR(context.physicalDevice, this->surface, &surfaceFormatCount, nullptr);
     std::vector<VkSurfaceFormatKHR> surfaceFormats(surfaceFormatCount);
     vkGetPhysicalDeviceSurfaceFormatsKHR(context.physicalDevice, this->surface, &surfaceFormatCount, surfaceFormats.data());
 
-    this->swapchainExtent = surfaceCapabilities.currentExtent;
+    //the surface may leave the extent to the swapchain, then it follows
+    //the window
+    VkExtent2D extent = surfaceCapabilities.currentExtent;
+    if(extent.width == UINT32_MAX){
+        int width = static_cast<int>(this->requestedExtent.width);
+        int height = static_cast<int>(this->requestedExtent.height);
+        if(this->window != nullptr){
+            SDL_GetWindowSizeInPixels(this->window, &width, &height);
+        }
+        extent.width = std::min(std::max(static_cast<uint32_t>(width), surfaceCapabilities.minImageExtent.width), surfaceCapabilities.maxImageExtent.width);
+        extent.height = std::min(std::max(static_cast<uint32_t>(height), surfaceCapabilities.minImageExtent.height), surfaceCapabilities.maxImageExtent.height);
+    }
+    //minimized, nothing can be presented until the window has area again
+    if(extent.width == 0 || extent.height == 0){
+        return false;
+    }
+    this->swapchainExtent = extent;
 
     //create viewport based off surface
     this->viewport.x = 0.0f;
     this->viewport.y = 0.0f;
-    this->viewport.height = surfaceCapabilities.currentExtent.height;
-    this->viewport.width = surfaceCapabilities.currentExtent.width;
+    this->viewport.height = extent.height;
+    this->viewport.width = extent.width;
     this->viewport.maxDepth = 1.0f;
     this->viewport.minDepth = 0.0f;
-    std::cout<<this->viewport.height<< std::endl;
+
+    this->defaultScissor.offset = {0, 0};
+    this->defaultScissor.extent = extent;
+
+    this->choosePresentConfig(context, surfaceCapabilities);
+
+    //transfer source lets frames be read back, most surfaces allow it
+    VkImageUsageFlags imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    this->readable = (surfaceCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) != 0;
+    if(this->readable){
+        imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
 
     VkSwapchainCreateInfoKHR swapchainCI = {
         VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,        //sType
         nullptr,                                            //pNext
         {},                                                 //flags
         this->surface,                                      //surface
-        2,                                                  //minImageCount
+        this->imageCount,                                   //minImageCount
         VK_FORMAT_R8G8B8A8_SRGB,                            //imageFormat
         VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,                  //imageColorSpace
-        surfaceCapabilities.currentExtent,                              //imageExtent
+        extent,                                             //imageExtent
         1,                                                  //imageArrayLayers
-        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,                //imageUsage
+        imageUsage,                                         //imageUsage
         {},                                                 //imageSharingMode
         1,                                                  //queueFamilyIndexCount
         &context.queue.queueFamilyIndex,                    //pQueueFamilyIndices
         surfaceCapabilities.currentTransform,               //preTransform
         VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,                  //compositeAlpha
-        VK_PRESENT_MODE_MAILBOX_KHR,                        //presentMode
+        this->presentMode,                                  //presentMode
         VK_FALSE,                                           //clipped
-        nullptr                                             //oldSwapchain
+        this->swapchain                                     //oldSwapchain
     };
 
+    //the old swapchain is retired by this call but stays alive, images
+    //already acquired from it can still be presented
     if(vkCreateSwapchainKHR(context.device, &swapchainCI, nullptr, &this->swapchain) != VK_SUCCESS){
         std::cout << "could not create swapchain" << std::endl;
         exit(1);
     }
+    this->outOfDate = false;
+    return true;
 }
 
 std::vector<Image> Display::getImagesAndViews(Context & context){
+    //offscreen images are created once up front
+    if(this->offscreen){
+        return this->images;
+    }
+
     uint32_t swapchainImageCount = 0;
     std::vector<VkImageView> Vulk_imageViews;
     std::vector<VkImage> Vulk_images;
@@ -485,24 +928,239 @@ std::vector<Image> Display::getImagesAndViews(Context & context){
         };
         images.push_back(image);
     }
-    std::cout << images.size() << std::endl;
+    this->images = images;
     return images;
 }
 
-uint32_t Display::getNextPresentableSwapchainIndex(Context & context, Display & display, Semaphore & imageAvailable){
-    uint32_t imageIndex = 0;
-    vkAcquireNextImageKHR(context.device, display.swapchain, UINT64_MAX, imageAvailable.semaphore, nullptr, &imageIndex);
-    return imageIndex;
+uint32_t Display::getImageCount(Context & context){
+    if(this->offscreen){
+        return static_cast<uint32_t>(this->images.size());
+    }
+    uint32_t imageCount = 0;
+    vkGetSwapchainImagesKHR(context.device, this->swapchain, &imageCount, nullptr);
+    return imageCount;
+}
+
+VkResult Display::acquireNextImage(Context & context, Semaphore & imageAvailable, uint32_t & imageIndex){
+    //offscreen images rotate in order, the frame ring submits without
+    //waiting on imageAvailable
+    if(this->offscreen){
+        imageIndex = this->nextOffscreen;
+        this->nextOffscreen = (this->nextOffscreen + 1) % this->images.size();
+        this->acquireTime = steadyNanoseconds();
+        return VK_SUCCESS;
+    }
+
+    VkResult result = vkAcquireNextImageKHR(context.device, this->swapchain, UINT64_MAX, imageAvailable.semaphore, nullptr, &imageIndex);
+    this->acquireTime = steadyNanoseconds();
+    //suboptimal still hands out an image and signals the semaphore, it is
+    //presented and the swapchain replaced afterwards
+    if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR){
+        this->outOfDate = true;
+    }
+    else if(result != VK_SUCCESS){
+        std::cout << "could not acquire swapchain image" << std::endl;
+        exit(1);
+    }
+    return result;
+}
+
+void Display::choosePresentConfig(Context & context, const VkSurfaceCapabilitiesKHR & surfaceCapabilities){
+    uint32_t presentModeCount = 0;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(context.physicalDevice, this->surface, &presentModeCount, nullptr);
+    std::vector<VkPresentModeKHR> presentModes(presentModeCount);
+    vkGetPhysicalDeviceSurfacePresentModesKHR(context.physicalDevice, this->surface, &presentModeCount, presentModes.data());
+
+    //in order of preference, fifo is always supported and ends every list
+    std::vector<VkPresentModeKHR> preferred;
+    uint32_t desiredImages = 2;
+    switch(this->presentPolicy){
+        case PRESENT_LOWEST_LATENCY:
+            preferred = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR};
+            desiredImages = 2;
+            break;
+        case PRESENT_SMOOTH:
+            preferred = {VK_PRESENT_MODE_FIFO_KHR};
+            desiredImages = 3;
+            break;
+        case PRESENT_POWER_SAVER:
+            preferred = {VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_FIFO_KHR};
+            desiredImages = 2;
+            break;
+    }
+
+    this->presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    for(auto mode : preferred){
+        if(std::find(presentModes.begin(), presentModes.end(), mode) != presentModes.end()){
+            this->presentMode = mode;
+            break;
+        }
+    }
+
+    //maxImageCount 0 means no upper limit
+    this->imageCount = std::max(desiredImages, surfaceCapabilities.minImageCount);
+    if(surfaceCapabilities.maxImageCount != 0){
+        this->imageCount = std::min(this->imageCount, surfaceCapabilities.maxImageCount);
+    }
+
+    std::cout << "present policy " << presentPolicyName(this->presentPolicy) << ": " << presentModeName(this->presentMode)
+              << " with " << this->imageCount << " images at " << this->swapchainExtent.width << "x" << this->swapchainExtent.height << std::endl;
+}
+
+void Display::setPresentPolicy(PresentPolicy policy){
+    this->presentPolicy = policy;
+    this->outOfDate = true;
+}
+
+void Display::recordPresent(){
+    if(this->acquireTime == 0){
+        return;
+    }
+    double latency = (steadyNanoseconds() - this->acquireTime) / 1000000.0;
+    this->acquireTime = 0;
+    this->presentCount++;
+    this->latencyTotal += latency;
+    this->latencyMax = std::max(this->latencyMax, latency);
+}
+
+void Display::report(){
+    std::cout << "display: " << presentPolicyName(this->presentPolicy) << " policy, " << presentModeName(this->presentMode)
+              << " with " << this->imageCount << " images" << std::endl;
+    if(this->presentCount > 0){
+        std::cout << "display: acquire to present " << this->latencyTotal / this->presentCount << " ms average, "
+                  << this->latencyMax << " ms worst over " << this->presentCount << " frames" << std::endl;
+    }
 }
 
 void Display::initDisplay(Context & context, int width, int height){
+    this->requestedExtent = {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
     this->createWindowAndSurface(context, width, height);
-    this->createSwapchain(context);
+    if(!this->createSwapchain(context)){
+        std::cout << "could not create swapchain for a window without area" << std::endl;
+        exit(1);
+    }
+}
+
+void Display::initHeadless(Context & context, int width, int height, bool useSurface, uint32_t offscreenImages){
+    this->window = nullptr;
+    this->surface = VK_NULL_HANDLE;
+    this->requestedExtent = {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
+
+    if(useSurface && context.headlessSurfaceSupported && context.swapchainSupported){
+        VkHeadlessSurfaceCreateInfoEXT surfaceCI = {
+            VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT, //sType
+            nullptr,                                            //pNext
+            0                                                   //flags
+        };
+        if(vkCreateHeadlessSurfaceEXT(context.instance, &surfaceCI, nullptr, &this->surface) != VK_SUCCESS){
+            std::cout << "could not create headless surface" << std::endl;
+            exit(1);
+        }
+        if(!this->createSwapchain(context)){
+            std::cout << "could not create headless swapchain" << std::endl;
+            exit(1);
+        }
+        return;
+    }
+
+    this->offscreen = true;
+    this->readable = true;
+    this->swapchainExtent = this->requestedExtent;
+    this->viewport = {0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height), 0.0f, 1.0f};
+    this->defaultScissor = {{0, 0}, this->requestedExtent};
+    this->presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+    this->imageCount = std::max(offscreenImages, 1u);
+    this->createOffscreenImages(context, this->imageCount);
+    std::cout << "rendering offscreen into " << this->imageCount << " images at " << width << "x" << height << std::endl;
+}
+
+void Display::createOffscreenImages(Context & context, uint32_t count){
+    for(uint32_t i = 0; i < count; i++){
+        Image image = {};
+
+        //the same format the render pass and the swapchain use, readable
+        //by transfers for readback
+        VkImageCreateInfo imageCI = {
+            VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,                //sType
+            nullptr,                                            //pNext
+            0,                                                  //flags
+            VK_IMAGE_TYPE_2D,                                   //imageType
+            VK_FORMAT_R8G8B8A8_SRGB,                            //format
+            {this->swapchainExtent.width, this->swapchainExtent.height, 1}, //extent
+            1,                                                  //mipLevels
+            1,                                                  //arrayLayers
+            VK_SAMPLE_COUNT_1_BIT,                              //samples
+            VK_IMAGE_TILING_OPTIMAL,                            //tiling
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, //usage
+            VK_SHARING_MODE_EXCLUSIVE,                          //sharingMode
+            0,                                                  //queueFamilyIndexCount
+            nullptr,                                            //pQueueFamilyIndices
+            VK_IMAGE_LAYOUT_UNDEFINED                           //initialLayout
+        };
+        if(vkCreateImage(context.device, &imageCI, nullptr, &image.image) != VK_SUCCESS){
+            std::cout << "could not create offscreen image" << std::endl;
+            exit(1);
+        }
+
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(context.device, image.image, &requirements);
+        VkMemoryAllocateInfo allocInfo = {
+            VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,             //sType
+            nullptr,                                            //pNext
+            requirements.size,                                  //allocationSize
+            context.findMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) //memoryTypeIndex
+        };
+        VkDeviceMemory memory;
+        if(vkAllocateMemory(context.device, &allocInfo, nullptr, &memory) != VK_SUCCESS){
+            std::cout << "could not allocate offscreen image memory" << std::endl;
+            exit(1);
+        }
+        vkBindImageMemory(context.device, image.image, memory, 0);
+        this->offscreenMemory.push_back(memory);
+
+        VkImageViewCreateInfo imageViewCI = {
+            VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,           //sType
+            nullptr,                                            //pNext
+            0,                                                  //flags
+            image.image,                                        //image
+            VK_IMAGE_VIEW_TYPE_2D,                              //viewType
+            VK_FORMAT_R8G8B8A8_SRGB,                            //format
+            {},                                                 //components
+            {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}             //subresourceRange
+        };
+        if(vkCreateImageView(context.device, &imageViewCI, nullptr, &image.imageView) != VK_SUCCESS){
+            std::cout << "could not create offscreen image view" << std::endl;
+            exit(1);
+        }
+        this->images.push_back(image);
+    }
+}
+
+void Display::destroy(Context & context){
+    for(auto & image : this->images){
+        vkDestroyImageView(context.device, image.imageView, nullptr);
+        if(this->offscreen){
+            vkDestroyImage(context.device, image.image, nullptr);
+        }
+    }
+    for(auto memory : this->offscreenMemory){
+        vkFreeMemory(context.device, memory, nullptr);
+    }
+    this->images.clear();
+    this->offscreenMemory.clear();
 
-    VkRect2D scissor{};
-    scissor.offset = {0, 0};
-    scissor.extent = this->swapchainExtent;
-    this->defaultScissor = scissor;
+    if(this->swapchain != VK_NULL_HANDLE){
+        vkDestroySwapchainKHR(context.device, this->swapchain, nullptr);
+        this->swapchain = VK_NULL_HANDLE;
+    }
+    if(this->surface != VK_NULL_HANDLE){
+        vkDestroySurfaceKHR(context.instance, this->surface, nullptr);
+        this->surface = VK_NULL_HANDLE;
+    }
+    if(this->window != nullptr){
+        SDL_DestroyWindow(this->window);
+        this->window = nullptr;
+    }
 }
 
 //=====================================================================
@@ -544,30 +1202,262 @@ void CommandBuffer::initCommandBuffer(Context & context){
 }
 
 void CommandBuffer::initCommandBuffer(Context & context, VkCommandPool & pool){
-    this->createPool(context);
+    //the buffer belongs to the caller's pool, nothing of our own to create
+    this->pool = pool;
     this->allocateBuffer(context, pool); 
 }
 
 //=====================================================================
-//===============================RENDERPASS============================
+//===============================COMMANDALLOCATOR======================
 //=====================================================================
 
-void RenderPass::createFramebuffers(Context & context, std::vector<Image> images, VkExtent2D & extent){
-    this->frameBuffers.resize(images.size());
-    std::cout << images.size() << std::endl;
+void CommandAllocator::init(Context & context){
+    this->init(context, context.queue.queueFamilyIndex);
+}
 
-    for(int i = 0; i < images.size(); i++){
-    
-        VkFramebufferCreateInfo framebufferCI = {
-            VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,          //sType
-            nullptr,                                            //pNext
-            0,                                                  //flags
-            this->renderPass,                                   //renderPass
-            1,                                                  //attachmentCount
-            &images[i].imageView,
-            extent.width,                                       //width
-            extent.height,                                      //height
-            1                                                   //layers
+void CommandAllocator::init(Context & context, uint32_t queueFamilyIndex){
+    VkCommandPoolCreateInfo commandPoolCI = {
+        VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,         //sType
+        nullptr,                                            //pNext
+        VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,               //flags
+        queueFamilyIndex                                    //queueFamilyIndex
+    };
+
+    if(vkCreateCommandPool(context.device, &commandPoolCI, nullptr, &this->pool) != VK_SUCCESS){
+        std::cout << "could not create command allocator pool" << std::endl;
+        exit(1);
+    }
+    this->nextPrimary = 0;
+    this->nextSecondary = 0;
+}
+
+VkCommandBuffer CommandAllocator::allocate(Context & context, VkCommandBufferLevel level){
+    bool primary = level == VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    std::vector<VkCommandBuffer> & buffers = primary ? this->primaries : this->secondaries;
+    uint32_t & next = primary ? this->nextPrimary : this->nextSecondary;
+
+    //only grows while the frame's high water mark rises
+    if(next == buffers.size()){
+        VkCommandBufferAllocateInfo commandBufferAllocateI = {
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, //sType
+            nullptr,                                        //pNext
+            this->pool,                                     //commandPool
+            level,                                          //level
+            1                                               //commandBufferCount
+        };
+
+        VkCommandBuffer buffer;
+        if(vkAllocateCommandBuffers(context.device, &commandBufferAllocateI, &buffer) != VK_SUCCESS){
+            std::cout << "could not allocate command buffer" << std::endl;
+            exit(1);
+        }
+        buffers.push_back(buffer);
+    }
+    return buffers[next++];
+}
+
+void CommandAllocator::reset(Context & context){
+    //one call puts every buffer back to initial, they stay allocated for reuse
+    vkResetCommandPool(context.device, this->pool, 0);
+    this->nextPrimary = 0;
+    this->nextSecondary = 0;
+}
+
+void CommandAllocator::destroy(Context & context){
+    vkDestroyCommandPool(context.device, this->pool, nullptr);
+    this->primaries.clear();
+    this->secondaries.clear();
+}
+
+//=====================================================================
+//===============================COMMANDRECORDER=======================
+//=====================================================================
+
+static int bindPointIndex(VkPipelineBindPoint bindPoint){
+    if(bindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS){
+        return 0;
+    }
+    if(bindPoint == VK_PIPELINE_BIND_POINT_COMPUTE){
+        return 1;
+    }
+    return -1;
+}
+
+void CommandRecorder::begin(VkCommandBuffer commandBuffer){
+    this->commandBuffer = commandBuffer;
+    this->issued = 0;
+    this->dropped = 0;
+    this->invalidate();
+}
+
+void CommandRecorder::invalidate(){
+    for(auto & bindPoint : this->bindPoints){
+        bindPoint.pipeline = VK_NULL_HANDLE;
+        for(uint32_t i = 0; i < MAX_SHADOWED_SETS; i++){
+            bindPoint.setLayouts[i] = VK_NULL_HANDLE;
+            bindPoint.sets[i] = VK_NULL_HANDLE;
+        }
+    }
+    for(auto & binding : this->vertexBindings){
+        binding = {VK_NULL_HANDLE, 0};
+    }
+    this->indexBuffer = VK_NULL_HANDLE;
+    this->indexOffset = 0;
+    this->indexType = VK_INDEX_TYPE_UINT16;
+    this->pushLayout = VK_NULL_HANDLE;
+    this->pushStages = 0;
+    this->pushBegin = 0;
+    this->pushEnd = 0;
+    this->viewportSet = false;
+    this->scissorSet = false;
+}
+
+bool CommandRecorder::keep(bool changed){
+    if(changed){
+        this->issued++;
+    }
+    else{
+        this->dropped++;
+    }
+    return changed;
+}
+
+void CommandRecorder::bindPipeline(VkPipelineBindPoint bindPoint, VkPipeline pipeline){
+    int index = bindPointIndex(bindPoint);
+    if(!this->keep(index < 0 || this->bindPoints[index].pipeline != pipeline)){
+        return;
+    }
+    vkCmdBindPipeline(this->commandBuffer, bindPoint, pipeline);
+    if(index >= 0){
+        this->bindPoints[index].pipeline = pipeline;
+    }
+}
+
+void CommandRecorder::bindVertexBuffer(uint32_t binding, VkBuffer buffer, VkDeviceSize offset){
+    bool shadowed = binding < MAX_SHADOWED_BINDINGS;
+    if(!this->keep(!shadowed || this->vertexBindings[binding].buffer != buffer || this->vertexBindings[binding].offset != offset)){
+        return;
+    }
+    vkCmdBindVertexBuffers(this->commandBuffer, binding, 1, &buffer, &offset);
+    if(shadowed){
+        this->vertexBindings[binding] = {buffer, offset};
+    }
+}
+
+void CommandRecorder::bindIndexBuffer(VkBuffer buffer, VkDeviceSize offset, VkIndexType type){
+    if(!this->keep(this->indexBuffer != buffer || this->indexOffset != offset || this->indexType != type)){
+        return;
+    }
+    vkCmdBindIndexBuffer(this->commandBuffer, buffer, offset, type);
+    this->indexBuffer = buffer;
+    this->indexOffset = offset;
+    this->indexType = type;
+}
+
+void CommandRecorder::bindDescriptorSet(VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint32_t setIndex, VkDescriptorSet set){
+    int index = bindPointIndex(bindPoint);
+    bool shadowed = index >= 0 && setIndex < MAX_SHADOWED_SETS;
+    if(!this->keep(!shadowed || this->bindPoints[index].sets[setIndex] != set || this->bindPoints[index].setLayouts[setIndex] != layout)){
+        return;
+    }
+    vkCmdBindDescriptorSets(this->commandBuffer, bindPoint, layout, setIndex, 1, &set, 0, nullptr);
+    if(!shadowed){
+        return;
+    }
+
+    //a different layout may disturb every set above this one
+    BindPointState & state = this->bindPoints[index];
+    if(state.setLayouts[setIndex] != layout){
+        for(uint32_t i = setIndex + 1; i < MAX_SHADOWED_SETS; i++){
+            state.setLayouts[i] = VK_NULL_HANDLE;
+            state.sets[i] = VK_NULL_HANDLE;
+        }
+    }
+    state.setLayouts[setIndex] = layout;
+    state.sets[setIndex] = set;
+}
+
+void CommandRecorder::pushConstants(VkPipelineLayout layout, VkShaderStageFlags stages, uint32_t offset, uint32_t size, const void * data){
+    uint32_t end = offset + size;
+    bool shadowed = end <= SHADOWED_PUSH_BYTES;
+    bool same = shadowed && layout == this->pushLayout && stages == this->pushStages &&
+                offset >= this->pushBegin && end <= this->pushEnd &&
+                memcmp(this->pushData + offset, data, size) == 0;
+    if(!this->keep(!same)){
+        return;
+    }
+    vkCmdPushConstants(this->commandBuffer, layout, stages, offset, size, data);
+    if(!shadowed){
+        this->pushLayout = VK_NULL_HANDLE;
+        return;
+    }
+
+    //the known bytes grow while pushes to one layout stay contiguous
+    bool extends = layout == this->pushLayout && stages == this->pushStages && offset <= this->pushEnd && end >= this->pushBegin;
+    if(extends){
+        this->pushBegin = std::min(this->pushBegin, offset);
+        this->pushEnd = std::max(this->pushEnd, end);
+    }
+    else{
+        this->pushLayout = layout;
+        this->pushStages = stages;
+        this->pushBegin = offset;
+        this->pushEnd = end;
+    }
+    memcpy(this->pushData + offset, data, size);
+}
+
+void CommandRecorder::setViewport(const VkViewport & viewport){
+    bool same = this->viewportSet && memcmp(&this->viewport, &viewport, sizeof(VkViewport)) == 0;
+    if(!this->keep(!same)){
+        return;
+    }
+    vkCmdSetViewport(this->commandBuffer, 0, 1, &viewport);
+    this->viewport = viewport;
+    this->viewportSet = true;
+}
+
+void CommandRecorder::setScissor(const VkRect2D & scissor){
+    bool same = this->scissorSet && memcmp(&this->scissor, &scissor, sizeof(VkRect2D)) == 0;
+    if(!this->keep(!same)){
+        return;
+    }
+    vkCmdSetScissor(this->commandBuffer, 0, 1, &scissor);
+    this->scissor = scissor;
+    this->scissorSet = true;
+}
+
+void CommandRecorder::draw(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance){
+    vkCmdDraw(this->commandBuffer, vertexCount, instanceCount, firstVertex, firstInstance);
+}
+
+void CommandRecorder::drawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance){
+    vkCmdDrawIndexed(this->commandBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+}
+
+void CommandRecorder::report(){
+    std::cout << "command recorder: " << this->issued << " state changes issued, " << this->dropped << " dropped" << std::endl;
+}
+
+//=====================================================================
+//===============================RENDERPASS============================
+//=====================================================================
+
+void RenderPass::createFramebuffers(Context & context, std::vector<Image> images, VkExtent2D & extent){
+    this->frameBuffers.resize(images.size());
+
+    for(int i = 0; i < images.size(); i++){
+    
+        VkFramebufferCreateInfo framebufferCI = {
+            VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,          //sType
+            nullptr,                                            //pNext
+            0,                                                  //flags
+            this->renderPass,                                   //renderPass
+            1,                                                  //attachmentCount
+            &images[i].imageView,
+            extent.width,                                       //width
+            extent.height,                                      //height
+            1                                                   //layers
         };
 
         if(vkCreateFramebuffer(context.device, &framebufferCI, nullptr, &this->frameBuffers[i]) != VK_SUCCESS){
@@ -575,6 +1465,7 @@ void RenderPass::createFramebuffers(Context & context, std::vector<Image> images
             exit(1);
         }
     }
+    this->framebufferGeneration++;
 }
 
 void RenderPass::initRenderPass(Context & context, CommandBuffer & commandBuffer){
@@ -589,7 +1480,7 @@ void RenderPass::initRenderPass(Context & context, CommandBuffer & commandBuffer
         VK_ATTACHMENT_LOAD_OP_DONT_CARE,                        //stencilLoadOp
         VK_ATTACHMENT_STORE_OP_DONT_CARE,                       //stencilStoreOp
         VK_IMAGE_LAYOUT_UNDEFINED,                              //initialLayout
-        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR                         //finalLayout
+        this->finalLayout                                       //finalLayout
     };
 
     VkAttachmentReference * colorAttachmentRef = new VkAttachmentReference{
@@ -611,14 +1502,28 @@ void RenderPass::initRenderPass(Context & context, CommandBuffer & commandBuffer
 
     };
 
-    VkSubpassDependency * dependency = new VkSubpassDependency{
+    std::vector<VkSubpassDependency> dependencies = {{
         VK_SUBPASS_EXTERNAL,
         0,
         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
         0,
         VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
-    };
+    }};
+
+    //the implicit dependency out of the pass ends at bottom of pipe with no
+    //access, a copy straight after the pass has to be ordered explicitly
+    //behind the color writes and the final layout transition
+    if(this->readback){
+        dependencies.push_back({
+            0,
+            VK_SUBPASS_EXTERNAL,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_ACCESS_TRANSFER_READ_BIT
+        });
+    }
 
     VkRenderPassCreateInfo renderPassCI = {
         VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,              //sType
@@ -628,8 +1533,8 @@ void RenderPass::initRenderPass(Context & context, CommandBuffer & commandBuffer
         colorAttachment,                                       //pAttachments
         1,                                                      //subpassCount
         subpassDescription,                                    //pSubpasses
-        1,                                                      //dependencyCount
-        dependency                                             //pDependencies
+        static_cast<uint32_t>(dependencies.size()),             //dependencyCount
+        dependencies.data()                                     //pDependencies
     };
     
     if(vkCreateRenderPass(context.device, &renderPassCI, nullptr, &this->renderPass) != VK_SUCCESS){
@@ -661,7 +1566,17 @@ void RenderPass::setClearColor(float color[4]){
 }
 
 void RenderPass::startRenderPass(VkPipeline & pipeline, int imageIndex){
-    vkResetCommandBuffer(this->commandBuffer.buffer, 0);
+    this->startRenderPass(imageIndex, VK_SUBPASS_CONTENTS_INLINE);
+
+    //a null pipeline means the draw was skipped while its pipeline compiles
+    if(pipeline != VK_NULL_HANDLE){
+        this->recorder.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    }
+}
+
+void RenderPass::beginRecording(){
+    //frame buffers come back initial from a pool reset, begin resets any
+    //other buffer whose pool allows it
     VkCommandBufferBeginInfo commandBufferBeginCI = {
         VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
         nullptr
@@ -671,6 +1586,14 @@ void RenderPass::startRenderPass(VkPipeline & pipeline, int imageIndex){
         std::cout << "could not start command buffer" << std::endl;
         exit(1);
     }
+    this->recorder.begin(this->commandBuffer.buffer);
+    this->recording = true;
+}
+
+void RenderPass::startRenderPass(int imageIndex, VkSubpassContents contents){
+    if(!this->recording){
+        this->beginRecording();
+    }
     
     VkRenderPassBeginInfo renderPassInfo = {
         VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
@@ -682,44 +1605,80 @@ void RenderPass::startRenderPass(VkPipeline & pipeline, int imageIndex){
         &this->clearColor
     };
 
-    vkCmdBeginRenderPass(this->commandBuffer.buffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdBindPipeline(this->commandBuffer.buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    vkCmdBeginRenderPass(this->commandBuffer.buffer, &renderPassInfo, contents);
+
+    //secondaries set their own, nothing may be recorded here for them
+    if(contents == VK_SUBPASS_CONTENTS_INLINE){
+        VkViewport viewport = {
+            0.0f,                                                   //x
+            0.0f,                                                   //y
+            static_cast<float>(this->renderArea.extent.width),      //width
+            static_cast<float>(this->renderArea.extent.height),     //height
+            0.0f,                                                   //minDepth
+            1.0f                                                    //maxDepth
+        };
+        this->recorder.setViewport(viewport);
+        this->recorder.setScissor(this->renderArea);
+    }
+}
+
+void RenderPass::executeCommands(const std::vector<VkCommandBuffer> & secondaries){
+    if(secondaries.empty()){
+        return;
+    }
+    vkCmdExecuteCommands(this->commandBuffer.buffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+    //whatever the secondaries bound is unknown here
+    this->recorder.invalidate();
 }
 
-void RenderPass::endRenderPass(){
+void RenderPass::endRenderPass(bool keepRecording){
     vkCmdEndRenderPass(this->commandBuffer.buffer);
+    if(!keepRecording){
+        this->finishRecording();
+    }
+}
+
+void RenderPass::finishRecording(){
     if(vkEndCommandBuffer(this->commandBuffer.buffer) != VK_SUCCESS){
         std::cout << "could not record command buffer" << std::endl;
         exit(1);
     }
+    this->recording = false;
 }
 
 void RenderPass::drawVertices(VkPipeline pipeline, int vertexCount){
-    vkCmdDraw(this->commandBuffer.buffer, vertexCount, 1, 0, 0);
+    this->recorder.draw(vertexCount);
 }
 
 void RenderPass::drawIndexed(int indexCount){
-    vkCmdDrawIndexed(this->commandBuffer.buffer, indexCount, 1, 0,0,0);
+    this->recorder.drawIndexed(indexCount);
 }
 
-void RenderPass::submitWork(Context & context, Semaphore & wait, Semaphore & signal, Fence & fence){
-    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    VkSubmitInfo submitInfo = {
-        VK_STRUCTURE_TYPE_SUBMIT_INFO,                      //sType
-        nullptr,                                            //pNext
-        1,                                                  //waitSemaphoreCount
-        &wait.semaphore,                          //pWaitSemaphores
-        waitStages,                                         //pWaitDstStageMask
-        1,                                                  //commandBufferCount
-        &this->commandBuffer.buffer,                                    //pCommandBuffers
-        1,                                                  //signalSemaphoreCount
-        &signal.semaphore                         //pSignalSemaphores
-    };
+void RenderPass::bindInstances(VkBuffer buffer, VkDeviceSize offset){
+    this->recorder.bindVertexBuffer(INSTANCE_BINDING, buffer, offset);
+}
 
-    if(vkQueueSubmit(context.queue.queueFamily, 1, &submitInfo, fence.fence) != VK_SUCCESS){
-        std::cout << "could not submit command buffer to queue" << std::endl;
-        exit(1);
-    }
+void RenderPass::drawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance){
+    this->recorder.drawIndexed(indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+}
+
+void RenderPass::bindDescriptorSet(VkPipelineLayout layout, uint32_t setIndex, VkDescriptorSet set){
+    this->recorder.bindDescriptorSet(VK_PIPELINE_BIND_POINT_GRAPHICS, layout, setIndex, set);
+}
+
+void RenderPass::submitWork(SubmitBatcher & batcher, Semaphore & wait, Semaphore & signal){
+    //only the color writes need the swapchain image. presentation waits on
+    //everything, a readback may follow the pass and move the image back to
+    //the present layout after it
+    batcher.wait(wait.semaphore, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT);
+    batcher.add(this->commandBuffer.buffer);
+    batcher.signal(signal.semaphore, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT);
+}
+
+SyncToken RenderPass::submitWork(Context & context, Semaphore & wait, Semaphore & signal){
+    SubmitBatcher batcher;
+    this->submitWork(batcher, wait, signal);
+    return batcher.flush(context);
 }
 
 void RenderPass::submitPresentation(Context & context, Display & display, Semaphore & wait, uint32_t imageIndex){
@@ -733,7 +1692,15 @@ void RenderPass::submitPresentation(Context & context, Display & display, Semaph
         &imageIndex,
     };
 
-    vkQueuePresentKHR(context.queue.queueFamily, &presentInfo);
+    VkResult result = vkQueuePresentKHR(context.queue.queueFamily, &presentInfo);
+    display.recordPresent();
+    if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR){
+        display.outOfDate = true;
+    }
+    else if(result != VK_SUCCESS){
+        std::cout << "could not present swapchain image" << std::endl;
+        exit(1);
+    }
 }
 
 //=====================================================================
@@ -783,6 +1750,128 @@ void Fence::reset(Context & context){
     vkResetFences(context.device, 1, &this->fence);
 }
 
+//=====================================================================
+//===============================SUBMITBATCHER=========================
+//=====================================================================
+
+SubmitBatcher::Batch & SubmitBatcher::openBatch(bool forWait){
+    //waits only cover command buffers after them, and nothing may follow a
+    //signal in the same submit info, so either case needs a fresh one
+    bool fresh = this->batches.empty() ||
+                 this->batches.back().signalCount > 0 ||
+                 (forWait && this->batches.back().bufferCount > 0);
+    if(fresh){
+        Batch batch = {
+            static_cast<uint32_t>(this->waits.size()), 0,
+            static_cast<uint32_t>(this->buffers.size()), 0,
+            static_cast<uint32_t>(this->signals.size()), 0
+        };
+        this->batches.push_back(batch);
+    }
+    return this->batches.back();
+}
+
+void SubmitBatcher::wait(VkSemaphore semaphore, VkPipelineStageFlags2 stages, uint64_t value){
+    Batch & batch = this->openBatch(true);
+    this->waits.push_back({
+        VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,            //sType
+        nullptr,                                            //pNext
+        semaphore,                                          //semaphore
+        value,                                              //value
+        stages,                                             //stageMask
+        0                                                   //deviceIndex
+    });
+    batch.waitCount++;
+}
+
+void SubmitBatcher::wait(Context & context, const SyncToken & token, VkPipelineStageFlags2 stages){
+    if(token.value == 0 || context.isComplete(token)){
+        return;
+    }
+    this->wait(context.getTimeline(token.queue), stages, token.value);
+}
+
+void SubmitBatcher::add(VkCommandBuffer buffer){
+    Batch & batch = this->openBatch(false);
+    this->buffers.push_back({
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,       //sType
+        nullptr,                                            //pNext
+        buffer,                                             //commandBuffer
+        0                                                   //deviceMask
+    });
+    batch.bufferCount++;
+}
+
+void SubmitBatcher::signal(VkSemaphore semaphore, VkPipelineStageFlags2 stages, uint64_t value){
+    //signals close their batch, so several in a row still share one
+    if(this->batches.empty()){
+        this->openBatch(false);
+    }
+    Batch & batch = this->batches.back();
+    this->signals.push_back({
+        VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,            //sType
+        nullptr,                                            //pNext
+        semaphore,                                          //semaphore
+        value,                                              //value
+        stages,                                             //stageMask
+        0                                                   //deviceIndex
+    });
+    batch.signalCount++;
+}
+
+void SubmitBatcher::onSubmit(std::function<void(const SyncToken &)> callback){
+    this->submitted.push_back(std::move(callback));
+}
+
+SyncToken SubmitBatcher::flush(Context & context, uint32_t queue){
+    if(this->batches.empty()){
+        SyncToken token = context.lastSubmitted(queue);
+        for(auto & callback : this->submitted){
+            callback(token);
+        }
+        this->submitted.clear();
+        return token;
+    }
+
+    //retirement covers everything earlier on the queue, so the timeline
+    //only needs signalling once at the very end. the value is taken right
+    //before the submit so no other flush can get in between
+    SyncToken token = context.nextToken(queue);
+    this->signal(context.getTimeline(queue), VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, token.value);
+
+    this->submits.clear();
+    for(auto & batch : this->batches){
+        this->submits.push_back({
+            VK_STRUCTURE_TYPE_SUBMIT_INFO_2,                //sType
+            nullptr,                                        //pNext
+            0,                                              //flags
+            batch.waitCount,                                //waitSemaphoreInfoCount
+            this->waits.data() + batch.firstWait,           //pWaitSemaphoreInfos
+            batch.bufferCount,                              //commandBufferInfoCount
+            this->buffers.data() + batch.firstBuffer,       //pCommandBufferInfos
+            batch.signalCount,                              //signalSemaphoreInfoCount
+            this->signals.data() + batch.firstSignal        //pSignalSemaphoreInfos
+        });
+    }
+
+    if(vkQueueSubmit2(context.getQueue(queue), static_cast<uint32_t>(this->submits.size()), this->submits.data(), VK_NULL_HANDLE) != VK_SUCCESS){
+        std::cout << "could not submit command buffers to queue" << std::endl;
+        exit(1);
+    }
+
+    //keep the capacity, steady state frames allocate nothing
+    this->waits.clear();
+    this->buffers.clear();
+    this->signals.clear();
+    this->batches.clear();
+
+    for(auto & callback : this->submitted){
+        callback(token);
+    }
+    this->submitted.clear();
+    return token;
+}
+
 //=====================================================================
 //===============================VERTEX================================
 //=====================================================================
@@ -816,29 +1905,55 @@ std::vector<VkVertexInputAttributeDescription> * Vertex::getAttributeDescription
             return attributeDescriptions;
 }
 
-//=====================================================================
-//===============================BUFFER================================
-//=====================================================================
-uint32_t Buffer::findMemoryType(Context & context, uint32_t typeFilter, VkMemoryPropertyFlags properties){
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(context.physicalDevice, &memProperties);
+VkVertexInputBindingDescription InstanceData::getBindingDescription(){
+    VkVertexInputBindingDescription bindingDescription = {
+        INSTANCE_BINDING,                                       //binding
+        sizeof(InstanceData),                                   //stride
+        VK_VERTEX_INPUT_RATE_INSTANCE                           //inputRate
+    };
+    return bindingDescription;
+}
 
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-        if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
-        }
+std::vector<VkVertexInputAttributeDescription> InstanceData::getAttributeDescriptions(){
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+    //a mat4 attribute is four vec4 columns on consecutive locations
+    for(uint32_t column = 0; column < 4; column++){
+        attributeDescriptions.push_back({2 + column, INSTANCE_BINDING, VK_FORMAT_R32G32B32A32_SFLOAT,
+                                         static_cast<uint32_t>(offsetof(InstanceData, transform) + sizeof(glm::vec4) * column)});
     }
-
-    throw std::runtime_error("failed to find suitable memory type!");
+    attributeDescriptions.push_back({6, INSTANCE_BINDING, VK_FORMAT_R32G32B32A32_SFLOAT, static_cast<uint32_t>(offsetof(InstanceData, color))});
+    attributeDescriptions.push_back({7, INSTANCE_BINDING, VK_FORMAT_R32G32B32A32_SFLOAT, static_cast<uint32_t>(offsetof(InstanceData, custom))});
+    return attributeDescriptions;
 }
 
+//=====================================================================
+//===============================BUFFER================================
+//=====================================================================
 void Buffer::init(Context & context, VkDeviceSize size, VkBufferUsageFlagBits bufType, VkSharingMode sharingMode){
+    this->init(context, size, bufType, sharingMode, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+void Buffer::init(Context & context, VkDeviceSize size, VkBufferUsageFlags usage, VkSharingMode sharingMode, VkMemoryPropertyFlags memoryProperties){
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = size;
-    bufferInfo.usage = bufType;
+    bufferInfo.usage = usage;
     bufferInfo.sharingMode = sharingMode;
 
+    //concurrent buffers are shared between the graphics and compute
+    //families. on one family there is nothing to share with and exclusive
+    //already covers both queues
+    uint32_t queueFamilyIndices[] = {context.queue.queueFamilyIndex, context.computeQueue.queueFamilyIndex};
+    if(sharingMode == VK_SHARING_MODE_CONCURRENT){
+        if(queueFamilyIndices[0] == queueFamilyIndices[1]){
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        }
+        else{
+            bufferInfo.queueFamilyIndexCount = 2;
+            bufferInfo.pQueueFamilyIndices = queueFamilyIndices;
+        }
+    }
+
     this->bufferSize = size;
 
     if (vkCreateBuffer(context.device, &bufferInfo, nullptr, &this->buffer) != VK_SUCCESS) {
@@ -851,7 +1966,7 @@ void Buffer::init(Context & context, VkDeviceSize size, VkBufferUsageFlagBits bu
     VkMemoryAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
     allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(context, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    allocInfo.memoryTypeIndex = context.findMemoryType(memRequirements.memoryTypeBits, memoryProperties);
     
     if (vkAllocateMemory(context.device, &allocInfo, nullptr, &this->bufferMemory) != VK_SUCCESS) {
         throw std::runtime_error("failed to allocate buffer memory!");
@@ -863,8 +1978,38 @@ void Buffer::init(Context & context, VkDeviceSize size, VkBufferUsageFlagBits bu
 
 void Buffer::map(Context & context, void * data){
     //map
-    vkMapMemory(context.device, this->bufferMemory, 0, this->bufferSize, 0, &this->mappedMemory);
-        memcpy(this->mappedMemory, data, (size_t) this->bufferSize);
+    if(this->mappedMemory == nullptr){
+        vkMapMemory(context.device, this->bufferMemory, 0, this->bufferSize, 0, &this->mappedMemory);
+    }
+    memcpy(this->mappedMemory, data, (size_t) this->bufferSize);
+}
+
+void Buffer::write(Context & context, const void * data, VkDeviceSize offset, VkDeviceSize size){
+    memcpy(static_cast<char *>(this->getMapped(context)) + offset, data, (size_t) size);
+}
+
+void * Buffer::getMapped(Context & context){
+    if(this->mappedMemory == nullptr){
+        vkMapMemory(context.device, this->bufferMemory, 0, this->bufferSize, 0, &this->mappedMemory);
+    }
+    return this->mappedMemory;
+}
+
+void Buffer::invalidate(Context & context){
+    VkMappedMemoryRange range = {
+        VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,                  //sType
+        nullptr,                                                //pNext
+        this->bufferMemory,                                     //memory
+        0,                                                      //offset
+        VK_WHOLE_SIZE                                           //size
+    };
+    vkInvalidateMappedMemoryRanges(context.device, 1, &range);
+}
+
+void Buffer::destroy(Context & context){
+    vkDestroyBuffer(context.device, this->buffer, nullptr);
+    vkFreeMemory(context.device, this->bufferMemory, nullptr);
+    this->mappedMemory = nullptr;
 }
 //=====================================================================
 //===============================VERTEXBUFFER==========================
@@ -881,6 +2026,10 @@ void VertexBuffer::bind(CommandBuffer & cmdBuf){
     vkCmdBindVertexBuffers(cmdBuf.buffer, 0, 1, vertexBuffers, offsets);
 }
 
+void VertexBuffer::bind(CommandRecorder & recorder){
+    recorder.bindVertexBuffer(0, this->buffer.getBuffer());
+}
+
 //=====================================================================
 //===============================INDEXBUFFER==========================
 //=====================================================================
@@ -892,4 +2041,4121 @@ void IndexBuffer::init(Context & context, std::vector<uint16_t> indices){
 
 void IndexBuffer::bind(CommandBuffer & cmdBuf){
     vkCmdBindIndexBuffer(cmdBuf.buffer, this->buffer.getBuffer(), 0, VK_INDEX_TYPE_UINT16);
-}
\ No newline at end of file
+}
+
+void IndexBuffer::bind(CommandRecorder & recorder){
+    recorder.bindIndexBuffer(this->buffer.getBuffer(), 0, VK_INDEX_TYPE_UINT16);
+}
+
+//=====================================================================
+//===============================DYNAMICRING===========================
+//=====================================================================
+
+void DynamicRing::init(Context & context, VkDeviceSize regionSize, VkBufferUsageFlags usage, uint32_t framesInFlight){
+    //256 is the largest offset alignment the spec allows, so regions start
+    //on a boundary any use of the buffer accepts
+    VkDeviceSize alignment = 256;
+    this->regionSize = (regionSize + alignment - 1) / alignment * alignment;
+    this->regionCount = framesInFlight;
+    this->buffer.init(context, this->regionSize * framesInFlight, usage, VK_SHARING_MODE_EXCLUSIVE,
+                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    this->mapped = static_cast<char *>(this->buffer.getMapped(context));
+}
+
+void DynamicRing::beginFrame(uint32_t frameIndex){
+    this->region = frameIndex % this->regionCount;
+    this->head = 0;
+}
+
+DynamicAllocation DynamicRing::allocate(VkDeviceSize size, VkDeviceSize alignment){
+    VkDeviceSize offset = (this->head + alignment - 1) / alignment * alignment;
+    if(offset + size > this->regionSize){
+        std::cout << "dynamic ring region is full" << std::endl;
+        exit(1);
+    }
+    this->head = offset + size;
+
+    VkDeviceSize absolute = this->regionSize * this->region + offset;
+    DynamicAllocation allocation = {
+        this->buffer.getBuffer(),                               //buffer
+        absolute,                                               //offset
+        this->mapped + absolute                                 //data
+    };
+    return allocation;
+}
+
+void DynamicRing::destroy(Context & context){
+    this->buffer.destroy(context);
+    this->mapped = nullptr;
+}
+
+//=====================================================================
+//===============================THREADPOOL============================
+//=====================================================================
+
+void ThreadPool::init(uint32_t threadCount){
+    if(threadCount == 0){
+        threadCount = 1;
+    }
+    for(uint32_t i = 0; i < threadCount; i++){
+        this->workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+void ThreadPool::workerLoop(){
+    while(true){
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(this->jobMutex);
+            this->jobAvailable.wait(lock, [this]{ return this->stopping || !this->jobs.empty(); });
+            if(this->stopping && this->jobs.empty()){
+                return;
+            }
+            job = std::move(this->jobs.front());
+            this->jobs.pop();
+            this->activeJobs++;
+        }
+
+        job();
+
+        {
+            std::lock_guard<std::mutex> lock(this->jobMutex);
+            this->activeJobs--;
+            if(this->activeJobs == 0 && this->jobs.empty()){
+                this->jobsFinished.notify_all();
+            }
+        }
+    }
+}
+
+void ThreadPool::submit(std::function<void()> job){
+    {
+        std::lock_guard<std::mutex> lock(this->jobMutex);
+        this->jobs.push(std::move(job));
+    }
+    this->jobAvailable.notify_one();
+}
+
+void ThreadPool::waitIdle(){
+    std::unique_lock<std::mutex> lock(this->jobMutex);
+    this->jobsFinished.wait(lock, [this]{ return this->activeJobs == 0 && this->jobs.empty(); });
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(this->jobMutex);
+        this->stopping = true;
+    }
+    this->jobAvailable.notify_all();
+    for(auto & worker : this->workers){
+        worker.join();
+    }
+}
+
+//=====================================================================
+//===============================PIPELINE LIBRARY======================
+//=====================================================================
+
+uint64_t PipelineKey::hash() const{
+    //every field that changes the compiled pipeline
+    uint64_t hash = HASH_SEED;
+    hash = hashBytes(hash, this->vertexShader.data(), this->vertexShader.size());
+    hash = hashBytes(hash, this->fragmentShader.data(), this->fragmentShader.size());
+    hash = hashBytes(hash, &this->topology, sizeof(this->topology));
+    hash = hashBytes(hash, &this->polygonMode, sizeof(this->polygonMode));
+    hash = hashBytes(hash, &this->cullMode, sizeof(this->cullMode));
+    hash = hashBytes(hash, &this->frontFace, sizeof(this->frontFace));
+    hash = hashBytes(hash, &this->lineWidth, sizeof(this->lineWidth));
+    return hash;
+}
+
+bool PipelineKey::operator==(const PipelineKey & other) const{
+    return this->vertexShader == other.vertexShader &&
+           this->fragmentShader == other.fragmentShader &&
+           this->topology == other.topology &&
+           this->polygonMode == other.polygonMode &&
+           this->cullMode == other.cullMode &&
+           this->frontFace == other.frontFace &&
+           this->lineWidth == other.lineWidth;
+}
+
+//manifest layout: magic, version, count, then per key five 32 bit
+//state words followed by two shader paths with 32 bit length prefixes
+static const uint32_t MANIFEST_MAGIC = 0x464D4C50; //"PLMF"
+static const uint32_t MANIFEST_VERSION = 2;
+
+void PipelineLibrary::init(Context & context, RenderPass & renderPass, Display & display, std::string manifestPath){
+    this->renderPass = &renderPass;
+    this->display = &display;
+    this->manifestPath = manifestPath;
+
+    //seed the driver cache with last session's blobs if there are any
+    std::vector<char> cacheData;
+    std::ifstream cacheFile(manifestPath + ".cache", std::ios::ate | std::ios::binary);
+    if(cacheFile.is_open()){
+        cacheData.resize((size_t) cacheFile.tellg());
+        cacheFile.seekg(0);
+        cacheFile.read(cacheData.data(), cacheData.size());
+    }
+
+    VkPipelineCacheCreateInfo pipelineCacheCI = {
+        VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,           //sType
+        nullptr,                                                //pNext
+        0,                                                      //flags
+        cacheData.size(),                                       //initialDataSize
+        cacheData.empty() ? nullptr : cacheData.data()          //pInitialData
+    };
+
+    if(vkCreatePipelineCache(context.device, &pipelineCacheCI, nullptr, &this->pipelineCache) != VK_SUCCESS){
+        std::cout << "could not create pipeline cache" << std::endl;
+        exit(1);
+    }
+
+    //every library pipeline shares one layout carrying the per-draw push constants
+    PipelineBuilder layoutBuilder;
+    layoutBuilder.setPushConstants<DrawData>(VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+    layoutBuilder.setPipelineLayout(context);
+    this->pipelineLayout = layoutBuilder.getPipelineLayout();
+}
+
+VkPipeline PipelineLibrary::buildPipeline(Context & context, const PipelineKey & key){
+    PipelineBuilder pipelineBuilder;
+    pipelineBuilder.setShader(context, VK_SHADER_STAGE_VERTEX_BIT, key.vertexShader, "main");
+    pipelineBuilder.setShader(context, VK_SHADER_STAGE_FRAGMENT_BIT, key.fragmentShader, "main");
+    pipelineBuilder.setInputAssembly(key.topology);
+    pipelineBuilder.setVertexInputState();
+    pipelineBuilder.setTessellationState();
+    pipelineBuilder.setViewportState(this->display->viewport, this->display->defaultScissor);
+    pipelineBuilder.setRasterizationState(key.polygonMode, key.cullMode, key.frontFace, key.lineWidth);
+    pipelineBuilder.setMultisampleState();
+    pipelineBuilder.setColorblendState();
+    pipelineBuilder.setPipelineLayout(this->pipelineLayout);
+
+    VkPipeline pipeline = pipelineBuilder.createPipeline(context, *this->renderPass, this->pipelineCache);
+    pipelineBuilder.releaseShaderModules(context);
+    return pipeline;
+}
+
+//call with pipelineMutex held, releases the key's reservation
+void PipelineLibrary::publish(const PipelineKey & key, VkPipeline pipeline){
+    this->pipelines[key] = pipeline;
+    this->pendingKeys.erase(key);
+    this->pipelineReady.notify_all();
+}
+
+std::vector<PipelineKey> PipelineLibrary::loadManifest(){
+    std::vector<PipelineKey> keys;
+    std::ifstream file(this->manifestPath, std::ios::binary);
+    if(!file.is_open()){
+        return keys;
+    }
+
+    file.seekg(0, std::ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    file.seekg(0);
+
+    uint32_t header[3] = {};
+    file.read(reinterpret_cast<char *>(header), sizeof(header));
+    if(!file || header[0] != MANIFEST_MAGIC || header[1] != MANIFEST_VERSION){
+        std::cout << "ignoring stale pipeline manifest " << this->manifestPath << std::endl;
+        return keys;
+    }
+
+    //a length past the end of the file means the manifest is corrupt
+    auto readPath = [&file, fileSize](std::string & path){
+        uint32_t length = 0;
+        file.read(reinterpret_cast<char *>(&length), sizeof(length));
+        if(!file || length > fileSize - static_cast<uint64_t>(file.tellg())){
+            file.setstate(std::ios::failbit);
+            return;
+        }
+        path.resize(length);
+        file.read(&path[0], length);
+    };
+
+    for(uint32_t i = 0; i < header[2]; i++){
+        uint32_t state[4] = {};
+        PipelineKey key = {};
+        file.read(reinterpret_cast<char *>(state), sizeof(state));
+        file.read(reinterpret_cast<char *>(&key.lineWidth), sizeof(key.lineWidth));
+        readPath(key.vertexShader);
+        readPath(key.fragmentShader);
+        if(!file){
+            break;
+        }
+
+        key.topology = static_cast<VkPrimitiveTopology>(state[0]);
+        key.polygonMode = static_cast<VkPolygonMode>(state[1]);
+        key.cullMode = static_cast<VkCullModeFlagBits>(state[2]);
+        key.frontFace = static_cast<VkFrontFace>(state[3]);
+        keys.push_back(key);
+    }
+    return keys;
+}
+
+void PipelineLibrary::warmup(Context & context, ThreadPool & threadPool){
+    std::vector<PipelineKey> keys = this->loadManifest();
+    auto start = std::chrono::steady_clock::now();
+
+    uint32_t submitted = 0;
+    for(auto & key : keys){
+        //the manifest outlives builds and --shaders, a key whose shaders
+        //are gone is stale and simply not warmed
+        if(!std::ifstream(key.vertexShader).good() || !std::ifstream(key.fragmentShader).good()){
+            std::cout << "skipping stale manifest entry " << key.vertexShader << ", " << key.fragmentShader << std::endl;
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(this->pipelineMutex);
+            if(this->pipelines.count(key) != 0 || !this->pendingKeys.insert(key).second){
+                continue;
+            }
+        }
+        threadPool.submit([this, &context, key]{
+            VkPipeline pipeline;
+            try{
+                pipeline = this->buildPipeline(context, key);
+            }catch(const std::runtime_error &){
+                //removed since the check above, give the key up so a later
+                //lookup builds or reports it itself
+                std::cout << "could not warm up pipeline " << key.vertexShader << ", " << key.fragmentShader << std::endl;
+                std::lock_guard<std::mutex> lock(this->pipelineMutex);
+                this->pendingKeys.erase(key);
+                this->pipelineReady.notify_all();
+                return;
+            }
+            std::lock_guard<std::mutex> lock(this->pipelineMutex);
+            this->publish(key, pipeline);
+        });
+        submitted++;
+    }
+    threadPool.waitIdle();
+
+    auto end = std::chrono::steady_clock::now();
+    this->warmupMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+    this->warmupCount = submitted;
+    this->warmedUp = true;
+
+    std::cout << "pipeline warm-up: " << this->warmupCount << " pipelines on " << threadPool.getThreadCount()
+              << " threads in " << this->warmupMilliseconds << " ms" << std::endl;
+}
+
+void PipelineLibrary::enableAsyncCompilation(ThreadPool & threadPool){
+    this->asyncPool = &threadPool;
+}
+
+void PipelineLibrary::setFallbackPipeline(Context & context, const PipelineKey & key){
+    //the fallback itself is built up front so it can never be missing
+    VkPipeline pipeline = this->buildOnce(context, key);
+    std::lock_guard<std::mutex> lock(this->pipelineMutex);
+    this->fallbackPipeline = pipeline;
+}
+
+VkPipeline PipelineLibrary::getPipeline(Context & context, const PipelineKey & key){
+    {
+        std::lock_guard<std::mutex> lock(this->pipelineMutex);
+        if(this->usedKeySet.insert(key).second){
+            this->usedKeys.push_back(key);
+        }
+
+        auto found = this->pipelines.find(key);
+        if(found != this->pipelines.end()){
+            return found->second;
+        }
+
+        if(this->asyncPool != nullptr){
+            //queue it once and substitute until the worker publishes it
+            if(this->pendingKeys.insert(key).second){
+                if(this->warmedUp){
+                    this->misses++;
+                }
+                this->asyncPool->submit([this, &context, key]{
+                    VkPipeline pipeline = this->buildPipeline(context, key);
+                    std::lock_guard<std::mutex> lock(this->pipelineMutex);
+                    this->publish(key, pipeline);
+                });
+            }
+
+            if(this->fallbackPipeline != VK_NULL_HANDLE){
+                this->fallbackLookups++;
+            }else{
+                this->skippedLookups++;
+            }
+            return this->fallbackPipeline;
+        }
+
+        if(this->warmedUp && this->pendingKeys.count(key) == 0){
+            this->misses++;
+        }
+    }
+
+    //not in the manifest, this is the hitch warm-up exists to avoid
+    return this->buildOnce(context, key);
+}
+
+VkPipeline PipelineLibrary::buildOnce(Context & context, const PipelineKey & key){
+    {
+        std::unique_lock<std::mutex> lock(this->pipelineMutex);
+        //another thread is already compiling it, wait for that one instead
+        //of building a duplicate. a warm-up job that failed gives the key
+        //up without publishing, then it is built here
+        if(this->pendingKeys.count(key) != 0){
+            this->pipelineReady.wait(lock, [this, &key]{ return this->pendingKeys.count(key) == 0; });
+        }
+        auto found = this->pipelines.find(key);
+        if(found != this->pipelines.end()){
+            return found->second;
+        }
+        this->pendingKeys.insert(key);
+    }
+
+    VkPipeline pipeline = this->buildPipeline(context, key);
+    std::lock_guard<std::mutex> lock(this->pipelineMutex);
+    this->publish(key, pipeline);
+    return pipeline;
+}
+
+void PipelineLibrary::beginFrame(){
+    std::lock_guard<std::mutex> lock(this->pipelineMutex);
+    this->lastFrameFallbackLookups = this->fallbackLookups;
+    this->lastFrameSkippedLookups = this->skippedLookups;
+    this->fallbackLookups = 0;
+    this->skippedLookups = 0;
+}
+
+void PipelineLibrary::saveManifest(Context & context){
+    std::lock_guard<std::mutex> lock(this->pipelineMutex);
+
+    std::ofstream file(this->manifestPath, std::ios::binary | std::ios::trunc);
+    if(!file.is_open()){
+        std::cout << "could not write pipeline manifest " << this->manifestPath << std::endl;
+        return;
+    }
+
+    uint32_t header[3] = {MANIFEST_MAGIC, MANIFEST_VERSION, static_cast<uint32_t>(this->usedKeys.size())};
+    file.write(reinterpret_cast<const char *>(header), sizeof(header));
+
+    auto writePath = [&file](const std::string & path){
+        uint32_t length = static_cast<uint32_t>(path.size());
+        file.write(reinterpret_cast<const char *>(&length), sizeof(length));
+        file.write(path.data(), length);
+    };
+
+    for(auto & key : this->usedKeys){
+        uint32_t state[4] = {
+            static_cast<uint32_t>(key.topology),
+            static_cast<uint32_t>(key.polygonMode),
+            static_cast<uint32_t>(key.cullMode),
+            static_cast<uint32_t>(key.frontFace)
+        };
+        file.write(reinterpret_cast<const char *>(state), sizeof(state));
+        file.write(reinterpret_cast<const char *>(&key.lineWidth), sizeof(key.lineWidth));
+        writePath(key.vertexShader);
+        writePath(key.fragmentShader);
+    }
+
+    //keep the driver blobs next to the manifest so warm-up hits the cache
+    size_t cacheSize = 0;
+    vkGetPipelineCacheData(context.device, this->pipelineCache, &cacheSize, nullptr);
+    std::vector<char> cacheData(cacheSize);
+    if(cacheSize > 0 && vkGetPipelineCacheData(context.device, this->pipelineCache, &cacheSize, cacheData.data()) == VK_SUCCESS){
+        std::ofstream cacheFile(this->manifestPath + ".cache", std::ios::binary | std::ios::trunc);
+        cacheFile.write(cacheData.data(), cacheSize);
+    }
+}
+
+void PipelineLibrary::report(){
+    std::lock_guard<std::mutex> lock(this->pipelineMutex);
+    std::cout << "pipeline library: warmed " << this->warmupCount << " in " << this->warmupMilliseconds
+              << " ms, " << this->misses << " misses after warm-up, " << this->usedKeys.size()
+              << " keys recorded" << std::endl;
+}
+
+void PipelineLibrary::destroy(Context & context){
+    std::unique_lock<std::mutex> lock(this->pipelineMutex);
+    this->pipelineReady.wait(lock, [this]{ return this->pendingKeys.empty(); });
+
+    for(auto & pipeline : this->pipelines){
+        vkDestroyPipeline(context.device, pipeline.second, nullptr);
+    }
+    this->pipelines.clear();
+    this->fallbackPipeline = VK_NULL_HANDLE;
+    vkDestroyPipelineLayout(context.device, this->pipelineLayout, nullptr);
+    vkDestroyPipelineCache(context.device, this->pipelineCache, nullptr);
+}
+
+//=====================================================================
+//===============================DESCRIPTORS===========================
+//=====================================================================
+
+//sets per pool for each size class, the last class repeats once reached
+static const uint32_t DESCRIPTOR_POOL_SIZE_CLASSES[] = {64, 256, 1024, 4096};
+
+//descriptors of each type reserved per set in a pool
+static const std::pair<VkDescriptorType, float> DESCRIPTOR_POOL_RATIOS[] = {
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.0f},
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.0f},
+    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.0f},
+    {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1.0f},
+    {VK_DESCRIPTOR_TYPE_SAMPLER, 0.5f},
+    {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f}
+};
+
+void DescriptorLayout::addBinding(uint32_t binding, VkDescriptorType type, VkShaderStageFlags stages, uint32_t count){
+    VkDescriptorSetLayoutBinding layoutBinding = {
+        binding,                                                //binding
+        type,                                                   //descriptorType
+        count,                                                  //descriptorCount
+        stages,                                                 //stageFlags
+        nullptr                                                 //pImmutableSamplers
+    };
+
+    this->bindings.push_back(layoutBinding);
+}
+
+void DescriptorLayout::init(Context & context){
+    //the allocator's pools only reserve the types in the ratio table, and a
+    //set has to fit the smallest pool or growing never helps
+    std::unordered_map<uint32_t, uint32_t> typeCounts;
+    for(auto & binding : this->bindings){
+        typeCounts[binding.descriptorType] += binding.descriptorCount;
+    }
+    for(auto & typeCount : typeCounts){
+        float ratio = 0.0f;
+        for(auto & poolRatio : DESCRIPTOR_POOL_RATIOS){
+            if(poolRatio.first == static_cast<VkDescriptorType>(typeCount.first)){
+                ratio = poolRatio.second;
+            }
+        }
+        if(ratio == 0.0f){
+            std::cout << "descriptor type " << typeCount.first << " is not supported by the descriptor allocator" << std::endl;
+            exit(1);
+        }
+        if(typeCount.second > static_cast<uint32_t>(ratio * DESCRIPTOR_POOL_SIZE_CLASSES[0])){
+            std::cout << "descriptor set layout needs " << typeCount.second << " descriptors of type " << typeCount.first
+                      << ", more than a descriptor pool holds" << std::endl;
+            exit(1);
+        }
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutCI = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,    //sType
+        nullptr,                                                //pNext
+        0,                                                      //flags
+        static_cast<uint32_t>(this->bindings.size()),           //bindingCount
+        this->bindings.data()                                   //pBindings
+    };
+
+    if(vkCreateDescriptorSetLayout(context.device, &layoutCI, nullptr, &this->layout) != VK_SUCCESS){
+        std::cout << "could not create descriptor set layout" << std::endl;
+        exit(1);
+    }
+}
+
+VkDescriptorPool DescriptorAllocator::createPool(Context & context){
+    uint32_t maxSets = DESCRIPTOR_POOL_SIZE_CLASSES[this->sizeClass];
+    if(this->sizeClass + 1 < sizeof(DESCRIPTOR_POOL_SIZE_CLASSES) / sizeof(DESCRIPTOR_POOL_SIZE_CLASSES[0])){
+        this->sizeClass++;
+    }
+
+    std::vector<VkDescriptorPoolSize> poolSizes;
+    for(auto & ratio : DESCRIPTOR_POOL_RATIOS){
+        poolSizes.push_back({ratio.first, static_cast<uint32_t>(ratio.second * maxSets)});
+    }
+
+    VkDescriptorPoolCreateInfo poolCI = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,          //sType
+        nullptr,                                                //pNext
+        0,                                                      //flags
+        maxSets,                                                //maxSets
+        static_cast<uint32_t>(poolSizes.size()),                //poolSizeCount
+        poolSizes.data()                                        //pPoolSizes
+    };
+
+    VkDescriptorPool pool = VK_NULL_HANDLE;
+    if(vkCreateDescriptorPool(context.device, &poolCI, nullptr, &pool) != VK_SUCCESS){
+        std::cout << "could not create descriptor pool" << std::endl;
+        exit(1);
+    }
+    return pool;
+}
+
+void DescriptorAllocator::nextPool(Context & context){
+    if(!this->freePools.empty()){
+        this->currentPool = this->freePools.back();
+        this->freePools.pop_back();
+    }else{
+        this->currentPool = this->createPool(context);
+    }
+    this->usedPools.push_back(this->currentPool);
+}
+
+VkDescriptorSet DescriptorAllocator::allocate(Context & context, VkDescriptorSetLayout layout){
+    if(this->currentPool == VK_NULL_HANDLE){
+        this->nextPool(context);
+    }
+
+    VkDescriptorSetAllocateInfo allocateI = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,         //sType
+        nullptr,                                                //pNext
+        this->currentPool,                                      //descriptorPool
+        1,                                                      //descriptorSetCount
+        &layout                                                 //pSetLayouts
+    };
+
+    VkDescriptorSet set = VK_NULL_HANDLE;
+    VkResult result = vkAllocateDescriptorSets(context.device, &allocateI, &set);
+    if(result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL){
+        //current pool is full, grow into a fresh one and retry once
+        this->nextPool(context);
+        allocateI.descriptorPool = this->currentPool;
+        result = vkAllocateDescriptorSets(context.device, &allocateI, &set);
+    }
+
+    if(result != VK_SUCCESS){
+        std::cout << "could not allocate descriptor set" << std::endl;
+        exit(1);
+    }
+    return set;
+}
+
+void DescriptorAllocator::reset(Context & context){
+    for(auto pool : this->usedPools){
+        vkResetDescriptorPool(context.device, pool, 0);
+        this->freePools.push_back(pool);
+    }
+    this->usedPools.clear();
+    this->currentPool = VK_NULL_HANDLE;
+}
+
+void DescriptorAllocator::destroy(Context & context){
+    this->reset(context);
+    for(auto pool : this->freePools){
+        vkDestroyDescriptorPool(context.device, pool, nullptr);
+    }
+    this->freePools.clear();
+    this->sizeClass = 0;
+}
+
+static bool sameWrites(const std::vector<DescriptorWrite> & a, const std::vector<DescriptorWrite> & b){
+    if(a.size() != b.size()){
+        return false;
+    }
+    for(size_t i = 0; i < a.size(); i++){
+        if(a[i].binding != b[i].binding ||
+           a[i].type != b[i].type ||
+           a[i].bufferInfo.buffer != b[i].bufferInfo.buffer ||
+           a[i].bufferInfo.offset != b[i].bufferInfo.offset ||
+           a[i].bufferInfo.range != b[i].bufferInfo.range ||
+           a[i].imageInfo.sampler != b[i].imageInfo.sampler ||
+           a[i].imageInfo.imageView != b[i].imageInfo.imageView ||
+           a[i].imageInfo.imageLayout != b[i].imageInfo.imageLayout){
+            return false;
+        }
+    }
+    return true;
+}
+
+VkDescriptorSet DescriptorCache::getSet(Context & context, VkDescriptorSetLayout layout, const std::vector<DescriptorWrite> & writes){
+    uint64_t hash = hashBytes(HASH_SEED, &layout, sizeof(layout));
+    for(auto & write : writes){
+        hash = hashBytes(hash, &write.binding, sizeof(write.binding));
+        hash = hashBytes(hash, &write.type, sizeof(write.type));
+        hash = hashBytes(hash, &write.bufferInfo.buffer, sizeof(write.bufferInfo.buffer));
+        hash = hashBytes(hash, &write.bufferInfo.offset, sizeof(write.bufferInfo.offset));
+        hash = hashBytes(hash, &write.bufferInfo.range, sizeof(write.bufferInfo.range));
+        hash = hashBytes(hash, &write.imageInfo.sampler, sizeof(write.imageInfo.sampler));
+        hash = hashBytes(hash, &write.imageInfo.imageView, sizeof(write.imageInfo.imageView));
+        hash = hashBytes(hash, &write.imageInfo.imageLayout, sizeof(write.imageInfo.imageLayout));
+    }
+
+    //the hash only narrows the search, the full key decides
+    auto range = this->sets.equal_range(hash);
+    for(auto found = range.first; found != range.second; found++){
+        if(found->second.layout == layout && sameWrites(found->second.writes, writes)){
+            return found->second.set;
+        }
+    }
+
+    VkDescriptorSet set = this->allocator.allocate(context, layout);
+
+    std::vector<VkWriteDescriptorSet> descriptorWrites;
+    for(auto & write : writes){
+        bool isImage = write.type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER ||
+                       write.type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE ||
+                       write.type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE ||
+                       write.type == VK_DESCRIPTOR_TYPE_SAMPLER;
+
+        VkWriteDescriptorSet descriptorWrite = {
+            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,             //sType
+            nullptr,                                            //pNext
+            set,                                                //dstSet
+            write.binding,                                      //dstBinding
+            0,                                                  //dstArrayElement
+            1,                                                  //descriptorCount
+            write.type,                                         //descriptorType
+            isImage ? &write.imageInfo : nullptr,               //pImageInfo
+            isImage ? nullptr : &write.bufferInfo,              //pBufferInfo
+            nullptr                                             //pTexelBufferView
+        };
+        descriptorWrites.push_back(descriptorWrite);
+    }
+    vkUpdateDescriptorSets(context.device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+    this->sets.insert({hash, {layout, writes, set}});
+    return set;
+}
+
+void DescriptorCache::destroy(Context & context){
+    this->allocator.destroy(context);
+    this->sets.clear();
+}
+
+//=====================================================================
+//===============================BINDLESS==============================
+//=====================================================================
+
+void BindlessTable::init(Context & context, uint32_t maxBuffers, uint32_t maxImages){
+    if(!context.bindlessSupported){
+        std::cout << "device does not support descriptor indexing" << std::endl;
+        exit(1);
+    }
+
+    //every binding is visible to all stages, so both the per set and the per
+    //stage update-after-bind limits apply
+    VkPhysicalDeviceVulkan12Properties limits12 = {};
+    limits12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &limits12;
+    vkGetPhysicalDeviceProperties2(context.physicalDevice, &properties);
+
+    uint32_t bufferLimit = std::min(limits12.maxDescriptorSetUpdateAfterBindStorageBuffers,
+                                    limits12.maxPerStageDescriptorUpdateAfterBindStorageBuffers);
+    uint32_t imageLimit = std::min({limits12.maxDescriptorSetUpdateAfterBindSampledImages,
+                                    limits12.maxDescriptorSetUpdateAfterBindSamplers,
+                                    limits12.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                                    limits12.maxPerStageDescriptorUpdateAfterBindSamplers});
+    uint32_t clampedBuffers = std::min(maxBuffers, bufferLimit);
+    uint32_t clampedImages = std::min(maxImages, imageLimit);
+    //a combined image sampler counts once against the per stage total
+    uint32_t resourceLimit = limits12.maxPerStageUpdateAfterBindResources;
+    if(clampedBuffers > resourceLimit / 2 && clampedImages > resourceLimit / 2){
+        clampedBuffers = resourceLimit / 2;
+        clampedImages = resourceLimit - clampedBuffers;
+    }else if(clampedBuffers + clampedImages > resourceLimit){
+        if(clampedBuffers > clampedImages){
+            clampedBuffers = resourceLimit - clampedImages;
+        }else{
+            clampedImages = resourceLimit - clampedBuffers;
+        }
+    }
+    if(clampedBuffers == 0 || clampedImages == 0){
+        std::cout << "device cannot hold a bindless table" << std::endl;
+        exit(1);
+    }
+    if(clampedBuffers != maxBuffers || clampedImages != maxImages){
+        std::cout << "bindless table clamped to " << clampedBuffers << " buffers and " << clampedImages
+                  << " images by device limits" << std::endl;
+    }
+
+    maxBuffers = clampedBuffers;
+    maxImages = clampedImages;
+    this->maxBuffers = maxBuffers;
+    this->maxImages = maxImages;
+
+    VkDescriptorSetLayoutBinding bindings[2] = {
+        {
+            BUFFER_BINDING,                                     //binding
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,                  //descriptorType
+            maxBuffers,                                         //descriptorCount
+            VK_SHADER_STAGE_ALL,                                //stageFlags
+            nullptr                                             //pImmutableSamplers
+        },
+        {
+            IMAGE_BINDING,                                      //binding
+            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,          //descriptorType
+            maxImages,                                          //descriptorCount
+            VK_SHADER_STAGE_ALL,                                //stageFlags
+            nullptr                                             //pImmutableSamplers
+        }
+    };
+
+    //only the last binding may have a variable count
+    VkDescriptorBindingFlags bindingFlags[2] = {
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT,
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+        VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT
+    };
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCI = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,  //sType
+        nullptr,                                                            //pNext
+        2,                                                                  //bindingCount
+        bindingFlags                                                        //pBindingFlags
+    };
+
+    VkDescriptorSetLayoutCreateInfo layoutCI = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,    //sType
+        &bindingFlagsCI,                                        //pNext
+        VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT, //flags
+        2,                                                      //bindingCount
+        bindings                                                //pBindings
+    };
+
+    if(vkCreateDescriptorSetLayout(context.device, &layoutCI, nullptr, &this->layout) != VK_SUCCESS){
+        std::cout << "could not create bindless set layout" << std::endl;
+        exit(1);
+    }
+
+    VkDescriptorPoolSize poolSizes[2] = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxBuffers},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, maxImages}
+    };
+
+    VkDescriptorPoolCreateInfo poolCI = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,          //sType
+        nullptr,                                                //pNext
+        VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,        //flags
+        1,                                                      //maxSets
+        2,                                                      //poolSizeCount
+        poolSizes                                               //pPoolSizes
+    };
+
+    if(vkCreateDescriptorPool(context.device, &poolCI, nullptr, &this->pool) != VK_SUCCESS){
+        std::cout << "could not create bindless descriptor pool" << std::endl;
+        exit(1);
+    }
+
+    VkDescriptorSetVariableDescriptorCountAllocateInfo variableCountI = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO,   //sType
+        nullptr,                                                                    //pNext
+        1,                                                                          //descriptorSetCount
+        &maxImages                                                                  //pDescriptorCounts
+    };
+
+    VkDescriptorSetAllocateInfo allocateI = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,         //sType
+        &variableCountI,                                        //pNext
+        this->pool,                                             //descriptorPool
+        1,                                                      //descriptorSetCount
+        &this->layout                                           //pSetLayouts
+    };
+
+    if(vkAllocateDescriptorSets(context.device, &allocateI, &this->set) != VK_SUCCESS){
+        std::cout << "could not allocate bindless descriptor set" << std::endl;
+        exit(1);
+    }
+}
+
+uint32_t BindlessTable::allocateHandle(Context & context, std::vector<RetiredHandle> & retired, std::vector<uint32_t> & freeHandles, uint32_t & next, uint32_t max){
+    //handles whose last reader has retired become free again
+    for(size_t i = 0; i < retired.size();){
+        if(context.isComplete(retired[i].token)){
+            freeHandles.push_back(retired[i].handle);
+            retired[i] = retired.back();
+            retired.pop_back();
+        }else{
+            i++;
+        }
+    }
+
+    if(!freeHandles.empty()){
+        uint32_t handle = freeHandles.back();
+        freeHandles.pop_back();
+        return handle;
+    }
+    if(next >= max){
+        std::cout << "bindless table is full" << std::endl;
+        exit(1);
+    }
+    return next++;
+}
+
+uint32_t BindlessTable::addBuffer(Context & context, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range){
+    std::lock_guard<std::mutex> lock(this->updateMutex);
+    uint32_t handle = this->allocateHandle(context, this->retiredBuffers, this->freeBuffers, this->nextBuffer, this->maxBuffers);
+
+    VkDescriptorBufferInfo bufferInfo = {
+        buffer,                                                 //buffer
+        offset,                                                 //offset
+        range                                                   //range
+    };
+
+    VkWriteDescriptorSet write = {
+        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,                 //sType
+        nullptr,                                                //pNext
+        this->set,                                              //dstSet
+        BUFFER_BINDING,                                         //dstBinding
+        handle,                                                 //dstArrayElement
+        1,                                                      //descriptorCount
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,                      //descriptorType
+        nullptr,                                                //pImageInfo
+        &bufferInfo,                                            //pBufferInfo
+        nullptr                                                 //pTexelBufferView
+    };
+
+    //update-after-bind makes this legal while the set is bound in flight
+    vkUpdateDescriptorSets(context.device, 1, &write, 0, nullptr);
+    return handle;
+}
+
+uint32_t BindlessTable::addImage(Context & context, VkImageView imageView, VkSampler sampler, VkImageLayout imageLayout){
+    std::lock_guard<std::mutex> lock(this->updateMutex);
+    uint32_t handle = this->allocateHandle(context, this->retiredImages, this->freeImages, this->nextImage, this->maxImages);
+
+    VkDescriptorImageInfo imageInfo = {
+        sampler,                                                //sampler
+        imageView,                                              //imageView
+        imageLayout                                             //imageLayout
+    };
+
+    VkWriteDescriptorSet write = {
+        VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,                 //sType
+        nullptr,                                                //pNext
+        this->set,                                              //dstSet
+        IMAGE_BINDING,                                          //dstBinding
+        handle,                                                 //dstArrayElement
+        1,                                                      //descriptorCount
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,              //descriptorType
+        &imageInfo,                                             //pImageInfo
+        nullptr,                                                //pBufferInfo
+        nullptr                                                 //pTexelBufferView
+    };
+
+    vkUpdateDescriptorSets(context.device, 1, &write, 0, nullptr);
+    return handle;
+}
+
+void BindlessTable::removeBuffer(uint32_t handle, const SyncToken & lastUse){
+    std::lock_guard<std::mutex> lock(this->updateMutex);
+    this->retiredBuffers.push_back({lastUse, handle});
+}
+
+void BindlessTable::removeImage(uint32_t handle, const SyncToken & lastUse){
+    std::lock_guard<std::mutex> lock(this->updateMutex);
+    this->retiredImages.push_back({lastUse, handle});
+}
+
+void BindlessTable::bind(CommandBuffer & commandBuffer, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout, uint32_t setIndex){
+    vkCmdBindDescriptorSets(commandBuffer.buffer, bindPoint, pipelineLayout, setIndex, 1, &this->set, 0, nullptr);
+}
+
+void BindlessTable::destroy(Context & context){
+    vkDestroyDescriptorPool(context.device, this->pool, nullptr);
+    vkDestroyDescriptorSetLayout(context.device, this->layout, nullptr);
+}
+
+//=====================================================================
+//===============================TEXTURES==============================
+//=====================================================================
+
+static void createTextureImage(Context & context, Texture * texture, VkImageUsageFlags usage){
+    VkImageCreateInfo imageCI = {
+        VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,                    //sType
+        nullptr,                                                //pNext
+        0,                                                      //flags
+        VK_IMAGE_TYPE_2D,                                       //imageType
+        texture->format,                                        //format
+        {texture->width, texture->height, 1},                   //extent
+        texture->mipLevels,                                     //mipLevels
+        1,                                                      //arrayLayers
+        VK_SAMPLE_COUNT_1_BIT,                                  //samples
+        VK_IMAGE_TILING_OPTIMAL,                                //tiling
+        usage,                                                  //usage
+        VK_SHARING_MODE_EXCLUSIVE,                              //sharingMode
+        0,                                                      //queueFamilyIndexCount
+        nullptr,                                                //pQueueFamilyIndices
+        VK_IMAGE_LAYOUT_UNDEFINED                               //initialLayout
+    };
+
+    if(vkCreateImage(context.device, &imageCI, nullptr, &texture->image.image) != VK_SUCCESS){
+        std::cout << "could not create texture image" << std::endl;
+        exit(1);
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(context.device, texture->image.image, &memRequirements);
+
+    VkMemoryAllocateInfo allocInfo = {
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,                 //sType
+        nullptr,                                                //pNext
+        memRequirements.size,                                   //allocationSize
+        context.findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) //memoryTypeIndex
+    };
+
+    if(vkAllocateMemory(context.device, &allocInfo, nullptr, &texture->memory) != VK_SUCCESS){
+        std::cout << "could not allocate texture memory" << std::endl;
+        exit(1);
+    }
+    vkBindImageMemory(context.device, texture->image.image, texture->memory, 0);
+}
+
+static void createTextureView(Context & context, Texture * texture){
+    VkImageViewCreateInfo imageViewCI = {
+        VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,               //sType
+        nullptr,                                                //pNext
+        0,                                                      //flags
+        texture->image.image,                                   //image
+        VK_IMAGE_VIEW_TYPE_2D,                                  //viewType
+        texture->format,                                        //format
+        {},                                                     //components
+        {VK_IMAGE_ASPECT_COLOR_BIT, 0, texture->mipLevels, 0, 1} //subresourceRange
+    };
+
+    if(vkCreateImageView(context.device, &imageViewCI, nullptr, &texture->image.imageView) != VK_SUCCESS){
+        std::cout << "could not create texture image view" << std::endl;
+        exit(1);
+    }
+}
+
+VkSampler SamplerCache::getSampler(Context & context, VkFilter filter, VkSamplerAddressMode addressMode){
+    uint64_t hash = hashBytes(HASH_SEED, &filter, sizeof(filter));
+    hash = hashBytes(hash, &addressMode, sizeof(addressMode));
+
+    std::lock_guard<std::mutex> lock(this->samplerMutex);
+    auto found = this->samplers.find(hash);
+    if(found != this->samplers.end()){
+        return found->second;
+    }
+
+    //lod is left unclamped so one sampler serves every mip count
+    VkSamplerCreateInfo samplerCI = {
+        VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,                  //sType
+        nullptr,                                                //pNext
+        0,                                                      //flags
+        filter,                                                 //magFilter
+        filter,                                                 //minFilter
+        filter == VK_FILTER_LINEAR ? VK_SAMPLER_MIPMAP_MODE_LINEAR : VK_SAMPLER_MIPMAP_MODE_NEAREST, //mipmapMode
+        addressMode,                                            //addressModeU
+        addressMode,                                            //addressModeV
+        addressMode,                                            //addressModeW
+        0.0f,                                                   //mipLodBias
+        VK_FALSE,                                               //anisotropyEnable
+        1.0f,                                                   //maxAnisotropy
+        VK_FALSE,                                               //compareEnable
+        VK_COMPARE_OP_ALWAYS,                                   //compareOp
+        0.0f,                                                   //minLod
+        VK_LOD_CLAMP_NONE,                                      //maxLod
+        VK_BORDER_COLOR_INT_OPAQUE_BLACK,                       //borderColor
+        VK_FALSE                                                //unnormalizedCoordinates
+    };
+
+    VkSampler sampler = VK_NULL_HANDLE;
+    if(vkCreateSampler(context.device, &samplerCI, nullptr, &sampler) != VK_SUCCESS){
+        std::cout << "could not create sampler" << std::endl;
+        exit(1);
+    }
+    this->samplers[hash] = sampler;
+    return sampler;
+}
+
+void SamplerCache::destroy(Context & context){
+    for(auto & sampler : this->samplers){
+        vkDestroySampler(context.device, sampler.second, nullptr);
+    }
+    this->samplers.clear();
+}
+
+//https://qoiformat.org/qoi-specification.pdf, always expands to rgba
+bool decodeQOI(const std::vector<char> & file, uint32_t & width, uint32_t & height, std::vector<unsigned char> & pixels){
+    const unsigned char * bytes = reinterpret_cast<const unsigned char *>(file.data());
+    size_t size = file.size();
+    if(size < 14 + 8 || bytes[0] != 'q' || bytes[1] != 'o' || bytes[2] != 'i' || bytes[3] != 'f'){
+        return false;
+    }
+
+    width = (bytes[4] << 24) | (bytes[5] << 16) | (bytes[6] << 8) | bytes[7];
+    height = (bytes[8] << 24) | (bytes[9] << 16) | (bytes[10] << 8) | bytes[11];
+    unsigned char channels = bytes[12];
+    unsigned char colorspace = bytes[13];
+    if(width == 0 || height == 0 || (channels != 3 && channels != 4) || colorspace > 1){
+        return false;
+    }
+
+    //the spec caps images at 400 million pixels, and no op covers more
+    //than 62 pixels per byte, so anything larger is a corrupt header
+    size_t pixelCount = (size_t) width * height;
+    if(pixelCount > 400000000 || pixelCount > (size - 14 - 8) * 62){
+        return false;
+    }
+    pixels.resize(pixelCount * 4);
+
+    unsigned char index[64][4] = {};
+    unsigned char px[4] = {0, 0, 0, 255};
+    size_t position = 14;
+    size_t end = size - 8;
+    uint32_t run = 0;
+
+    for(size_t i = 0; i < pixelCount; i++){
+        if(run > 0){
+            run--;
+        }else if(position < end){
+            unsigned char op = bytes[position++];
+            if(op == 0xfe){
+                px[0] = bytes[position++];
+                px[1] = bytes[position++];
+                px[2] = bytes[position++];
+            }else if(op == 0xff){
+                px[0] = bytes[position++];
+                px[1] = bytes[position++];
+                px[2] = bytes[position++];
+                px[3] = bytes[position++];
+            }else if((op & 0xc0) == 0x00){
+                memcpy(px, index[op], 4);
+            }else if((op & 0xc0) == 0x40){
+                px[0] += ((op >> 4) & 0x03) - 2;
+                px[1] += ((op >> 2) & 0x03) - 2;
+                px[2] += (op & 0x03) - 2;
+            }else if((op & 0xc0) == 0x80){
+                unsigned char next = bytes[position++];
+                int greenDiff = (op & 0x3f) - 32;
+                px[0] += greenDiff - 8 + ((next >> 4) & 0x0f);
+                px[1] += greenDiff;
+                px[2] += greenDiff - 8 + (next & 0x0f);
+            }else{
+                run = op & 0x3f;
+            }
+            memcpy(index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64], px, 4);
+        }
+        memcpy(&pixels[i * 4], px, 4);
+    }
+    return true;
+}
+
+void TextureLoader::init(Context & context, ThreadPool & threadPool, SamplerCache & samplerCache){
+    this->decodePool = &threadPool;
+    this->samplerCache = &samplerCache;
+    this->commandBuffer.initCommandBuffer(context);
+
+    this->bcSupported = context.features.textureCompressionBC;
+    this->astcSupported = context.features.textureCompressionASTC_LDR;
+
+    //host copies land in a layout the device lists for them, shader read
+    //only when it can so the texture is sampled without another transition
+    this->context = &context;
+    this->hostCopyEnabled = context.hostImageCopySupported;
+    if(this->hostCopyEnabled){
+        VkPhysicalDeviceHostImageCopyPropertiesEXT hostCopyProperties = {};
+        hostCopyProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2 properties = {};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties.pNext = &hostCopyProperties;
+        vkGetPhysicalDeviceProperties2(context.physicalDevice, &properties);
+
+        std::vector<VkImageLayout> dstLayouts(hostCopyProperties.copyDstLayoutCount);
+        hostCopyProperties.pCopyDstLayouts = dstLayouts.data();
+        vkGetPhysicalDeviceProperties2(context.physicalDevice, &properties);
+
+        this->hostCopyLayout = VK_IMAGE_LAYOUT_GENERAL;
+        for(auto layout : dstLayouts){
+            if(layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL){
+                this->hostCopyLayout = layout;
+            }
+        }
+    }
+}
+
+bool TextureLoader::useHostCopy(VkFormat format){
+    if(!this->hostCopyEnabled){
+        return false;
+    }
+
+    VkFormatProperties3 formatProperties3 = {};
+    formatProperties3.sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_3;
+    VkFormatProperties2 formatProperties = {};
+    formatProperties.sType = VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_2;
+    formatProperties.pNext = &formatProperties3;
+    vkGetPhysicalDeviceFormatProperties2(this->context->physicalDevice, format, &formatProperties);
+    if(!(formatProperties3.optimalTilingFeatures & VK_FORMAT_FEATURE_2_HOST_IMAGE_TRANSFER_BIT_EXT)){
+        return false;
+    }
+
+    //only worth it where the host writes the layout the gpu reads, which is
+    //the case on unified memory and software devices. elsewhere the staging
+    //copy lets the gpu swizzle into its preferred layout
+    VkHostImageCopyDevicePerformanceQueryEXT performance = {};
+    performance.sType = VK_STRUCTURE_TYPE_HOST_IMAGE_COPY_DEVICE_PERFORMANCE_QUERY_EXT;
+    VkImageFormatProperties2 imageProperties = {};
+    imageProperties.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2;
+    imageProperties.pNext = &performance;
+
+    VkPhysicalDeviceImageFormatInfo2 imageFormatInfo = {};
+    imageFormatInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2;
+    imageFormatInfo.format = format;
+    imageFormatInfo.type = VK_IMAGE_TYPE_2D;
+    imageFormatInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageFormatInfo.usage = VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+    if(vkGetPhysicalDeviceImageFormatProperties2(this->context->physicalDevice, &imageFormatInfo, &imageProperties) != VK_SUCCESS){
+        return false;
+    }
+    return performance.optimalDeviceAccess;
+}
+
+bool TextureLoader::hostUpload(const std::string & path, Texture * texture){
+    MappedFile file;
+    if(!file.open(path)){
+        return false;
+    }
+
+    DecodedImage image = {};
+    uint32_t blockWidth, blockHeight, blockBytes;
+    if(!decodeKTX2(file.data, file.size, image, false) || !blockFormatInfo(image.format, blockWidth, blockHeight, blockBytes)){
+        return false;
+    }
+    if(!this->useHostCopy(image.format)){
+        return false;
+    }
+
+    Context & context = *this->context;
+    texture->width = image.width;
+    texture->height = image.height;
+    texture->format = image.format;
+    texture->mipLevels = image.mipLevels;
+    texture->layout = this->hostCopyLayout;
+    createTextureImage(context, texture, VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT | VK_IMAGE_USAGE_SAMPLED_BIT);
+
+    VkHostImageLayoutTransitionInfoEXT transition = {
+        VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT,    //sType
+        nullptr,                                                    //pNext
+        texture->image.image,                                       //image
+        VK_IMAGE_LAYOUT_UNDEFINED,                                  //oldLayout
+        texture->layout,                                            //newLayout
+        {VK_IMAGE_ASPECT_COLOR_BIT, 0, texture->mipLevels, 0, 1}    //subresourceRange
+    };
+    if(vkTransitionImageLayoutEXT(context.device, 1, &transition) != VK_SUCCESS){
+        std::cout << "could not transition texture on the host" << std::endl;
+        exit(1);
+    }
+
+    //every level goes straight from the mapping into the image, no command buffer
+    std::vector<VkMemoryToImageCopyEXT> regions;
+    for(uint32_t level = 0; level < image.mipLevels; level++){
+        VkMemoryToImageCopyEXT region = {
+            VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT,             //sType
+            nullptr,                                                //pNext
+            file.data + image.levelOffsets[level],                  //pHostPointer
+            0,                                                      //memoryRowLength
+            0,                                                      //memoryImageHeight
+            {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1},               //imageSubresource
+            {0, 0, 0},                                              //imageOffset
+            {std::max(image.width >> level, 1u), std::max(image.height >> level, 1u), 1} //imageExtent
+        };
+        regions.push_back(region);
+    }
+
+    VkCopyMemoryToImageInfoEXT copyInfo = {
+        VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT,            //sType
+        nullptr,                                                    //pNext
+        0,                                                          //flags
+        texture->image.image,                                       //dstImage
+        texture->layout,                                            //dstImageLayout
+        static_cast<uint32_t>(regions.size()),                      //regionCount
+        regions.data()                                              //pRegions
+    };
+    if(vkCopyMemoryToImageEXT(context.device, &copyInfo) != VK_SUCCESS){
+        std::cout << "could not copy texture on the host" << std::endl;
+        exit(1);
+    }
+
+    createTextureView(context, texture);
+    texture->sampler = this->samplerCache->getSampler(context, VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT);
+
+    std::lock_guard<std::mutex> lock(this->decodedMutex);
+    this->hostCopied.push_back(texture);
+    return true;
+}
+
+bool TextureLoader::decodeFile(const std::string & path, DecodedImage & image){
+    std::vector<char> file;
+    try{
+        file = readFile(path);
+    }catch(const std::runtime_error &){
+        std::cout << "could not open texture " << path << std::endl;
+        return false;
+    }
+
+    if(path.size() < 5 || path.compare(path.size() - 5, 5, ".ktx2") != 0){
+        image.format = VK_FORMAT_R8G8B8A8_SRGB;
+        image.mipLevels = 1;
+        image.levelOffsets.push_back(0);
+        return decodeQOI(file, image.width, image.height, image.pixels);
+    }
+
+    if(!decodeKTX2(file, image)){
+        return false;
+    }
+
+    //rgba8 payloads are the universal intermediate, everything else is
+    //already block compressed and goes to the gpu exactly as stored
+    uint32_t blockWidth, blockHeight, blockBytes;
+    if(blockFormatInfo(image.format, blockWidth, blockHeight, blockBytes)){
+        bool isASTC = image.format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && image.format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK;
+        if((isASTC && !this->astcSupported) || (!isASTC && !this->bcSupported)){
+            std::cout << "device cannot sample the block format of " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    //only bc1/bc3 are encoded here. there is no bc5, bc7 or astc encoder, so
+    //devices without bc sample the rgba8 intermediate uncompressed; ship
+    //those formats precompressed in the ktx2 instead
+    if(this->bcSupported){
+        bool withAlpha = false;
+        for(size_t i = 3; i < image.pixels.size(); i += 4){
+            if(image.pixels[i] != 255){
+                withAlpha = true;
+                break;
+            }
+        }
+        transcodeToBC(image, withAlpha);
+    }
+    return true;
+}
+
+Texture * TextureLoader::load(std::string path){
+    this->textures.emplace_back();
+    Texture * texture = &this->textures.back();
+
+    {
+        std::lock_guard<std::mutex> lock(this->decodedMutex);
+        this->pendingDecodes++;
+    }
+
+    //decoding is the expensive part and scales with pool threads
+    this->decodePool->submit([this, texture, path]{
+        auto decode = [this, texture, &path]{
+            //precompressed ktx2 skips staging entirely where host copy pays off
+            bool isKTX2 = path.size() >= 5 && path.compare(path.size() - 5, 5, ".ktx2") == 0;
+            if(isKTX2 && this->hostUpload(path, texture)){
+                return;
+            }
+
+            DecodedImage image = {};
+            image.texture = texture;
+            if(!this->decodeFile(path, image)){
+                std::cout << "could not decode texture " << path << std::endl;
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(this->decodedMutex);
+            this->decoded.push_back(std::move(image));
+        };
+        decode();
+
+        std::lock_guard<std::mutex> lock(this->decodedMutex);
+        this->pendingDecodes--;
+        this->decodesFinished.notify_all();
+    });
+    return texture;
+}
+
+static void imageBarrier(VkCommandBuffer commandBuffer, VkImage image, uint32_t baseMip, uint32_t mipCount,
+                         VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+                         VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage){
+    VkImageMemoryBarrier barrier = {
+        VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,                 //sType
+        nullptr,                                                //pNext
+        srcAccess,                                              //srcAccessMask
+        dstAccess,                                              //dstAccessMask
+        oldLayout,                                              //oldLayout
+        newLayout,                                              //newLayout
+        VK_QUEUE_FAMILY_IGNORED,                                //srcQueueFamilyIndex
+        VK_QUEUE_FAMILY_IGNORED,                                //dstQueueFamilyIndex
+        image,                                                  //image
+        {VK_IMAGE_ASPECT_COLOR_BIT, baseMip, mipCount, 0, 1}    //subresourceRange
+    };
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void TextureLoader::recordUpload(Context & context, DecodedImage & decodedImage, Buffer & staging){
+    Texture * texture = decodedImage.texture;
+    texture->width = decodedImage.width;
+    texture->height = decodedImage.height;
+    texture->format = decodedImage.format;
+    texture->mipLevels = decodedImage.mipLevels;
+
+    //prebuilt chains and block formats are copied as is, a lone uncompressed
+    //level has the rest blitted, which needs linear filtering support
+    uint32_t blockWidth, blockHeight, blockBytes;
+    bool generateMips = decodedImage.mipLevels == 1 && !blockFormatInfo(texture->format, blockWidth, blockHeight, blockBytes);
+    if(generateMips){
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(context.physicalDevice, texture->format, &formatProperties);
+        generateMips = formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    }
+    if(generateMips){
+        uint32_t largest = texture->width > texture->height ? texture->width : texture->height;
+        while(largest > 1){
+            largest >>= 1;
+            texture->mipLevels++;
+        }
+    }
+
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    if(generateMips){
+        usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+    createTextureImage(context, texture, usage);
+
+    staging.init(context, decodedImage.pixels.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_SHARING_MODE_EXCLUSIVE,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    staging.map(context, decodedImage.pixels.data());
+
+    VkCommandBuffer cmd = this->commandBuffer.buffer;
+    imageBarrier(cmd, texture->image.image, 0, texture->mipLevels,
+                 VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    std::vector<VkBufferImageCopy> regions;
+    for(uint32_t level = 0; level < decodedImage.mipLevels; level++){
+        VkBufferImageCopy region = {
+            decodedImage.levelOffsets[level],                   //bufferOffset
+            0,                                                  //bufferRowLength
+            0,                                                  //bufferImageHeight
+            {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1},           //imageSubresource
+            {0, 0, 0},                                          //imageOffset
+            {std::max(texture->width >> level, 1u), std::max(texture->height >> level, 1u), 1} //imageExtent
+        };
+        regions.push_back(region);
+    }
+    vkCmdCopyBufferToImage(cmd, staging.getBuffer(), texture->image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           static_cast<uint32_t>(regions.size()), regions.data());
+
+    if(!generateMips){
+        imageBarrier(cmd, texture->image.image, 0, texture->mipLevels,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                     VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                     VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    }
+
+    //each level is blitted from the one above it, which is then done
+    int32_t mipWidth = texture->width;
+    int32_t mipHeight = texture->height;
+    for(uint32_t level = 1; generateMips && level < texture->mipLevels; level++){
+        imageBarrier(cmd, texture->image.image, level - 1, 1,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                     VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                     VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+        int32_t nextWidth = mipWidth > 1 ? mipWidth / 2 : 1;
+        int32_t nextHeight = mipHeight > 1 ? mipHeight / 2 : 1;
+        VkImageBlit blit = {
+            {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1},       //srcSubresource
+            {{0, 0, 0}, {mipWidth, mipHeight, 1}},              //srcOffsets
+            {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1},           //dstSubresource
+            {{0, 0, 0}, {nextWidth, nextHeight, 1}}             //dstOffsets
+        };
+        vkCmdBlitImage(cmd, texture->image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       texture->image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+        imageBarrier(cmd, texture->image.image, level - 1, 1,
+                     VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                     VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+                     VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+        mipWidth = nextWidth;
+        mipHeight = nextHeight;
+    }
+
+    if(generateMips){
+        imageBarrier(cmd, texture->image.image, texture->mipLevels - 1, 1,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                     VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                     VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    }
+
+    texture->layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    createTextureView(context, texture);
+    texture->sampler = this->samplerCache->getSampler(context, VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT);
+}
+
+void TextureLoader::update(Context & context){
+    SubmitBatcher batcher;
+    this->update(context, batcher);
+    batcher.flush(context);
+}
+
+void TextureLoader::update(Context & context, SubmitBatcher & batcher){
+    //host copies are complete the moment the worker returns
+    {
+        std::lock_guard<std::mutex> lock(this->decodedMutex);
+        for(auto texture : this->hostCopied){
+            texture->ready = true;
+        }
+        this->hostCopied.clear();
+    }
+
+    //retire the previous batch once the gpu is done with its staging memory.
+    //until its batcher flushes there is no token and nothing to wait on
+    if(this->uploadInFlight){
+        if(this->uploadToken.value == 0 || !context.isComplete(this->uploadToken)){
+            return;
+        }
+        for(auto & staging : this->stagingInFlight){
+            staging.destroy(context);
+        }
+        for(auto texture : this->texturesInFlight){
+            texture->ready = true;
+        }
+        this->stagingInFlight.clear();
+        this->texturesInFlight.clear();
+        this->uploadInFlight = false;
+    }
+
+    std::vector<DecodedImage> batch;
+    {
+        std::lock_guard<std::mutex> lock(this->decodedMutex);
+        batch.swap(this->decoded);
+    }
+    if(batch.empty()){
+        return;
+    }
+
+    vkResetCommandBuffer(this->commandBuffer.buffer, 0);
+    VkCommandBufferBeginInfo commandBufferBeginCI = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,            //sType
+        nullptr,                                                //pNext
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT             //flags
+    };
+
+    if(vkBeginCommandBuffer(this->commandBuffer.buffer, &commandBufferBeginCI) != VK_SUCCESS){
+        std::cout << "could not start upload command buffer" << std::endl;
+        exit(1);
+    }
+
+    this->stagingInFlight.resize(batch.size());
+    for(size_t i = 0; i < batch.size(); i++){
+        this->recordUpload(context, batch[i], this->stagingInFlight[i]);
+        this->texturesInFlight.push_back(batch[i].texture);
+    }
+
+    if(vkEndCommandBuffer(this->commandBuffer.buffer) != VK_SUCCESS){
+        std::cout << "could not record upload command buffer" << std::endl;
+        exit(1);
+    }
+
+    //goes out with whatever else the batcher collects this frame
+    batcher.add(this->commandBuffer.buffer);
+    this->uploadToken = {};
+    batcher.onSubmit([this](const SyncToken & token){ this->uploadToken = token; });
+    this->uploadInFlight = true;
+}
+
+void TextureLoader::destroy(Context & context){
+    {
+        std::unique_lock<std::mutex> lock(this->decodedMutex);
+        this->decodesFinished.wait(lock, [this]{ return this->pendingDecodes == 0; });
+    }
+    this->decoded.clear();
+
+    //an upload whose batcher never flushed was never seen by the gpu
+    if(this->uploadInFlight && this->uploadToken.value != 0){
+        context.wait(this->uploadToken);
+    }
+    for(auto & staging : this->stagingInFlight){
+        staging.destroy(context);
+    }
+    this->stagingInFlight.clear();
+
+    for(auto & texture : this->textures){
+        if(texture.image.image == VK_NULL_HANDLE){
+            continue;
+        }
+        vkDestroyImageView(context.device, texture.image.imageView, nullptr);
+        vkDestroyImage(context.device, texture.image.image, nullptr);
+        vkFreeMemory(context.device, texture.memory, nullptr);
+    }
+    this->textures.clear();
+}
+
+//=====================================================================
+//===============================KTX2==================================
+//=====================================================================
+
+bool blockFormatInfo(VkFormat format, uint32_t & blockWidth, uint32_t & blockHeight, uint32_t & blockBytes){
+    if(format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK){
+        blockWidth = 4;
+        blockHeight = 4;
+        bool eightByte = format <= VK_FORMAT_BC1_RGBA_SRGB_BLOCK ||
+                         format == VK_FORMAT_BC4_UNORM_BLOCK || format == VK_FORMAT_BC4_SNORM_BLOCK;
+        blockBytes = eightByte ? 8 : 16;
+        return true;
+    }
+
+    if(format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK){
+        //unorm and srgb alternate, so each footprint covers two formats
+        static const uint32_t footprints[14][2] = {
+            {4, 4}, {5, 4}, {5, 5}, {6, 5}, {6, 6}, {8, 5}, {8, 6},
+            {8, 8}, {10, 5}, {10, 6}, {10, 8}, {10, 10}, {12, 10}, {12, 12}
+        };
+        uint32_t footprint = (format - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) / 2;
+        blockWidth = footprints[footprint][0];
+        blockHeight = footprints[footprint][1];
+        blockBytes = 16;
+        return true;
+    }
+    return false;
+}
+
+static uint32_t readU32(const unsigned char * bytes){
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static uint64_t readU64(const unsigned char * bytes){
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+bool decodeKTX2(const std::vector<char> & file, DecodedImage & image){
+    return decodeKTX2(reinterpret_cast<const unsigned char *>(file.data()), file.size(), image, true);
+}
+
+//https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html, single 2d
+//images without supercompression. without copyLevels the level offsets
+//point into bytes and pixels stays empty
+bool decodeKTX2(const unsigned char * bytes, size_t size, DecodedImage & image, bool copyLevels){
+    static const unsigned char identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+    if(size < 80 || memcmp(bytes, identifier, sizeof(identifier)) != 0){
+        return false;
+    }
+
+    VkFormat format = static_cast<VkFormat>(readU32(bytes + 12));
+    uint32_t width = readU32(bytes + 20);
+    uint32_t height = readU32(bytes + 24);
+    uint32_t depth = readU32(bytes + 28);
+    uint32_t layerCount = readU32(bytes + 32);
+    uint32_t faceCount = readU32(bytes + 36);
+    uint32_t levelCount = readU32(bytes + 40);
+    uint32_t supercompression = readU32(bytes + 44);
+
+    if(depth > 1 || layerCount > 1 || faceCount != 1 || supercompression != 0 || width == 0 || height == 0){
+        std::cout << "unsupported ktx2 layout" << std::endl;
+        return false;
+    }
+
+    //uncompressed payloads are measured as 1x1 blocks of 4 bytes
+    uint32_t blockWidth = 1, blockHeight = 1, blockBytes = 4;
+    if(!blockFormatInfo(format, blockWidth, blockHeight, blockBytes) &&
+       format != VK_FORMAT_R8G8B8A8_UNORM && format != VK_FORMAT_R8G8B8A8_SRGB){
+        std::cout << "unsupported ktx2 format " << format << std::endl;
+        return false;
+    }
+
+    //a level count of 0 asks the loader to generate the chain
+    if(levelCount == 0){
+        levelCount = 1;
+    }
+    if(80 + (size_t) levelCount * 24 > size){
+        return false;
+    }
+
+    image.format = format;
+    image.width = width;
+    image.height = height;
+    image.mipLevels = levelCount;
+    image.levelOffsets.clear();
+    image.pixels.clear();
+
+    for(uint32_t level = 0; level < levelCount; level++){
+        const unsigned char * levelIndex = bytes + 80 + level * 24;
+        uint64_t byteOffset = readU64(levelIndex);
+        uint64_t byteLength = readU64(levelIndex + 8);
+
+        uint32_t levelWidth = std::max(width >> level, 1u);
+        uint32_t levelHeight = std::max(height >> level, 1u);
+        uint64_t expected = (uint64_t) ((levelWidth + blockWidth - 1) / blockWidth) *
+                            ((levelHeight + blockHeight - 1) / blockHeight) * blockBytes;
+        if(byteLength < expected || byteOffset > size || expected > size - byteOffset){
+            std::cout << "truncated ktx2 level " << level << std::endl;
+            return false;
+        }
+
+        if(!copyLevels){
+            image.levelOffsets.push_back(byteOffset);
+            continue;
+        }
+
+        //buffer to image copies want block aligned offsets
+        size_t offset = (image.pixels.size() + 15) & ~(size_t) 15;
+        image.pixels.resize(offset + expected);
+        memcpy(&image.pixels[offset], bytes + byteOffset, expected);
+        image.levelOffsets.push_back(offset);
+    }
+    return true;
+}
+
+//=====================================================================
+//===============================BC TRANSCODER=========================
+//=====================================================================
+
+//per channel min and max of a 4x4 rgba block, 16 lanes at a time
+static void blockBounds(const unsigned char block[64], unsigned char minColor[4], unsigned char maxColor[4]){
+#ifdef RENDER_SSE2
+    __m128i row0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block));
+    __m128i row1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16));
+    __m128i row2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 32));
+    __m128i row3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 48));
+
+    __m128i low = _mm_min_epu8(_mm_min_epu8(row0, row1), _mm_min_epu8(row2, row3));
+    __m128i high = _mm_max_epu8(_mm_max_epu8(row0, row1), _mm_max_epu8(row2, row3));
+
+    //fold the four pixels in each register down to one
+    low = _mm_min_epu8(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(2, 3, 0, 1)));
+    low = _mm_min_epu8(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(1, 0, 3, 2)));
+    high = _mm_max_epu8(high, _mm_shuffle_epi32(high, _MM_SHUFFLE(2, 3, 0, 1)));
+    high = _mm_max_epu8(high, _mm_shuffle_epi32(high, _MM_SHUFFLE(1, 0, 3, 2)));
+
+    int lowPixel = _mm_cvtsi128_si32(low);
+    int highPixel = _mm_cvtsi128_si32(high);
+    memcpy(minColor, &lowPixel, 4);
+    memcpy(maxColor, &highPixel, 4);
+#else
+    for(int c = 0; c < 4; c++){
+        minColor[c] = 255;
+        maxColor[c] = 0;
+    }
+    for(int i = 0; i < 16; i++){
+        for(int c = 0; c < 4; c++){
+            minColor[c] = std::min(minColor[c], block[i * 4 + c]);
+            maxColor[c] = std::max(maxColor[c], block[i * 4 + c]);
+        }
+    }
+#endif
+}
+
+static uint16_t packColor565(const int color[3]){
+    return static_cast<uint16_t>((((color[0] * 31 + 127) / 255) << 11) |
+                                 (((color[1] * 63 + 127) / 255) << 5) |
+                                 ((color[2] * 31 + 127) / 255));
+}
+
+static void unpackColor565(uint16_t packed, int color[3]){
+    int r = (packed >> 11) & 31;
+    int g = (packed >> 5) & 63;
+    int b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+//range fit along the bounding box diagonal, inset slightly to cut error
+static void encodeColorBlock(const unsigned char block[64], const unsigned char minColor[4], const unsigned char maxColor[4], unsigned char * out){
+    int low[3], high[3];
+    for(int c = 0; c < 3; c++){
+        int inset = (maxColor[c] - minColor[c]) >> 4;
+        low[c] = minColor[c] + inset;
+        high[c] = maxColor[c] - inset;
+    }
+
+    uint16_t color0 = packColor565(high);
+    uint16_t color1 = packColor565(low);
+    if(color0 < color1){
+        std::swap(color0, color1);
+    }
+
+    uint32_t indices = 0;
+    if(color0 != color1){
+        int palette[4][3];
+        unpackColor565(color0, palette[0]);
+        unpackColor565(color1, palette[1]);
+        for(int c = 0; c < 3; c++){
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        for(int i = 0; i < 16; i++){
+            int best = 0;
+            int bestError = INT_MAX;
+            for(int p = 0; p < 4; p++){
+                int dr = block[i * 4] - palette[p][0];
+                int dg = block[i * 4 + 1] - palette[p][1];
+                int db = block[i * 4 + 2] - palette[p][2];
+                int error = dr * dr + dg * dg + db * db;
+                if(error < bestError){
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= static_cast<uint32_t>(best) << (i * 2);
+        }
+    }
+
+    memcpy(out, &color0, 2);
+    memcpy(out + 2, &color1, 2);
+    memcpy(out + 4, &indices, 4);
+}
+
+static void encodeAlphaBlock(const unsigned char block[64], unsigned char minAlpha, unsigned char maxAlpha, unsigned char * out){
+    out[0] = maxAlpha;
+    out[1] = minAlpha;
+
+    uint64_t indices = 0;
+    if(maxAlpha != minAlpha){
+        int palette[8] = {maxAlpha, minAlpha};
+        for(int p = 2; p < 8; p++){
+            palette[p] = ((8 - p) * maxAlpha + (p - 1) * minAlpha) / 7;
+        }
+
+        for(int i = 0; i < 16; i++){
+            int best = 0;
+            int bestError = INT_MAX;
+            for(int p = 0; p < 8; p++){
+                int error = std::abs(block[i * 4 + 3] - palette[p]);
+                if(error < bestError){
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= static_cast<uint64_t>(best) << (i * 3);
+        }
+    }
+
+    for(int b = 0; b < 6; b++){
+        out[2 + b] = static_cast<unsigned char>(indices >> (b * 8));
+    }
+}
+
+//turns the rgba8 intermediate into bc1, or bc3 when alpha is used, level by
+//level. the only runtime encoder, other block formats have to come
+//precompressed
+void transcodeToBC(DecodedImage & image, bool withAlpha){
+    bool srgb = image.format == VK_FORMAT_R8G8B8A8_SRGB;
+    uint32_t blockBytes = withAlpha ? 16 : 8;
+
+    std::vector<unsigned char> encoded;
+    std::vector<VkDeviceSize> offsets;
+
+    for(uint32_t level = 0; level < image.mipLevels; level++){
+        uint32_t width = std::max(image.width >> level, 1u);
+        uint32_t height = std::max(image.height >> level, 1u);
+        uint32_t blocksX = (width + 3) / 4;
+        uint32_t blocksY = (height + 3) / 4;
+        const unsigned char * source = &image.pixels[image.levelOffsets[level]];
+
+        size_t offset = (encoded.size() + 15) & ~(size_t) 15;
+        encoded.resize(offset + (size_t) blocksX * blocksY * blockBytes);
+        offsets.push_back(offset);
+        unsigned char * out = &encoded[offset];
+
+        for(uint32_t by = 0; by < blocksY; by++){
+            for(uint32_t bx = 0; bx < blocksX; bx++){
+                //edge blocks repeat the last row and column
+                unsigned char block[64];
+                for(uint32_t y = 0; y < 4; y++){
+                    uint32_t sy = std::min(by * 4 + y, height - 1);
+                    for(uint32_t x = 0; x < 4; x++){
+                        uint32_t sx = std::min(bx * 4 + x, width - 1);
+                        memcpy(&block[(y * 4 + x) * 4], &source[((size_t) sy * width + sx) * 4], 4);
+                    }
+                }
+
+                unsigned char minColor[4], maxColor[4];
+                blockBounds(block, minColor, maxColor);
+                if(withAlpha){
+                    encodeAlphaBlock(block, minColor[3], maxColor[3], out);
+                    encodeColorBlock(block, minColor, maxColor, out + 8);
+                }else{
+                    encodeColorBlock(block, minColor, maxColor, out);
+                }
+                out += blockBytes;
+            }
+        }
+    }
+
+    if(withAlpha){
+        image.format = srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+    }else{
+        image.format = srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+    }
+    image.pixels.swap(encoded);
+    image.levelOffsets.swap(offsets);
+}
+
+//=====================================================================
+//===============================MAPPEDFILE============================
+//=====================================================================
+
+bool MappedFile::open(const std::string & path){
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE){
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(mapping == nullptr){
+        CloseHandle(file);
+        return false;
+    }
+    this->fileHandle = file;
+    this->mappingHandle = mapping;
+    this->size = (size_t) fileSize.QuadPart;
+    this->data = static_cast<const unsigned char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+    int file = ::open(path.c_str(), O_RDONLY);
+    if(file < 0){
+        return false;
+    }
+    struct stat fileStat;
+    fstat(file, &fileStat);
+    this->size = (size_t) fileStat.st_size;
+    void * mapped = mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, file, 0);
+    ::close(file);
+    if(mapped == MAP_FAILED){
+        this->size = 0;
+        return false;
+    }
+    this->data = static_cast<const unsigned char *>(mapped);
+#endif
+    return this->data != nullptr;
+}
+
+void MappedFile::close(){
+    if(this->data == nullptr){
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(this->data);
+    CloseHandle(this->mappingHandle);
+    CloseHandle(this->fileHandle);
+#else
+    munmap(const_cast<unsigned char *>(this->data), this->size);
+#endif
+    this->data = nullptr;
+    this->size = 0;
+}
+
+MappedFile::~MappedFile(){
+    this->close();
+}
+
+//=====================================================================
+//===============================DELETIONQUEUE=========================
+//=====================================================================
+
+void DeletionQueue::push(const SyncToken & token, std::function<void(Context &)> destroy){
+    this->entries.push_back({token, destroy});
+}
+
+void DeletionQueue::collect(Context & context){
+    //tokens from different queues complete out of order, so every entry
+    //is checked. survivors are compacted in the same pass
+    size_t kept = 0;
+    for(size_t i = 0; i < this->entries.size(); i++){
+        if(context.isComplete(this->entries[i].token)){
+            this->entries[i].destroy(context);
+        }
+        else{
+            if(kept != i){
+                this->entries[kept] = std::move(this->entries[i]);
+            }
+            kept++;
+        }
+    }
+    this->entries.resize(kept);
+}
+
+void DeletionQueue::flush(Context & context){
+    for(auto & entry : this->entries){
+        //a token past the last submit would never be reached
+        SyncToken token = entry.token;
+        token.value = std::min(token.value, context.lastSubmitted(token.queue).value);
+        context.wait(token);
+        entry.destroy(context);
+    }
+    this->entries.clear();
+}
+
+//=====================================================================
+//===============================FRAMERING=============================
+//=====================================================================
+
+void FrameRing::init(Context & context, Display & display, uint32_t depth){
+    if(depth == 0){
+        depth = 1;
+    }
+
+    this->frames.resize(depth);
+    for(auto & frame : this->frames){
+        frame.commands.init(context);
+        //the primary itself is handed out fresh in beginFrame
+        frame.commandBuffer.pool = frame.commands.getPool();
+        frame.commandBuffer.buffer = VK_NULL_HANDLE;
+        frame.imageAvailable.initSemaphore(context);
+        frame.submitted = {};
+        frame.imageIndex = 0;
+        frame.acquired = false;
+    }
+    this->createRenderFinished(context, display);
+}
+
+void FrameRing::createRenderFinished(Context & context, Display & display){
+    //present waits are tied to the swapchain image, not the frame slot,
+    //so a semaphore is never resignalled while a present still holds it
+    this->renderFinished.resize(display.getImageCount(context));
+    for(auto & semaphore : this->renderFinished){
+        semaphore.initSemaphore(context);
+    }
+}
+
+bool FrameRing::recreateSwapchain(Context & context, Display & display, RenderPass & renderPass){
+    VkSwapchainKHR oldSwapchain = display.swapchain;
+    std::vector<Image> oldImages = display.images;
+    std::vector<VkFramebuffer> oldFramebuffers = renderPass.frameBuffers;
+    std::vector<Semaphore> oldRenderFinished = this->renderFinished;
+
+    if(!display.createSwapchain(context)){
+        return false;
+    }
+
+    std::vector<Image> images = display.getImagesAndViews(context);
+    renderPass.setRenderArea(static_cast<int>(display.swapchainExtent.width), static_cast<int>(display.swapchainExtent.height));
+    renderPass.createFramebuffers(context, images, display.swapchainExtent);
+    this->createRenderFinished(context, display);
+
+    //frames already submitted keep rendering into and presenting the old
+    //images. presents carry no fence, so the old set waits until the frame
+    //a full ring later has been submitted and completed. timeline values
+    //are not frames, other submits advance them too
+    this->awaitingFrame.push_back({this->submittedFrames + this->frames.size(), [oldSwapchain, oldImages, oldFramebuffers, oldRenderFinished](Context & context){
+        for(auto framebuffer : oldFramebuffers){
+            vkDestroyFramebuffer(context.device, framebuffer, nullptr);
+        }
+        for(auto & image : oldImages){
+            vkDestroyImageView(context.device, image.imageView, nullptr);
+        }
+        for(auto & semaphore : oldRenderFinished){
+            vkDestroySemaphore(context.device, semaphore.semaphore, nullptr);
+        }
+        vkDestroySwapchainKHR(context.device, oldSwapchain, nullptr);
+    }});
+    this->swapchainRecreations++;
+    return true;
+}
+
+FrameContext & FrameRing::beginFrame(Context & context, Display & display, RenderPass & renderPass){
+    FrameContext & frame = this->frames[this->current];
+
+    //wait for the gpu to retire the last frame that used this slot, then
+    //everything it owned can be recycled. nothing to reset on a timeline
+    context.wait(frame.submitted);
+    frame.descriptors.reset(context);
+    frame.commands.reset(context);
+    frame.commandBuffer.pool = frame.commands.getPool();
+    frame.commandBuffer.buffer = frame.commands.allocate(context, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+    this->retired.collect(context);
+
+    //out of date acquires signal nothing, so the swapchain is replaced and
+    //the acquire retried. suboptimal ones are presented first
+    frame.acquired = false;
+    while(true){
+        if(display.outOfDate && !this->recreateSwapchain(context, display, renderPass)){
+            //minimized, sleep until the window changes and record a frame
+            //that is thrown away. headless runs never started sdl
+            if(context.headless){
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            else{
+                SDL_WaitEventTimeout(nullptr, 100);
+            }
+            frame.imageIndex = 0;
+            break;
+        }
+        if(display.acquireNextImage(context, frame.imageAvailable, frame.imageIndex) == VK_ERROR_OUT_OF_DATE_KHR){
+            continue;
+        }
+        frame.acquired = true;
+        break;
+    }
+
+    renderPass.commandBuffer = frame.commandBuffer;
+    return frame;
+}
+
+void FrameRing::endFrame(Context & context, Display & display, RenderPass & renderPass){
+    FrameContext & frame = this->frames[this->current];
+    //offscreen frames have nothing to wait on or present to
+    if(display.offscreen){
+        this->batcher.add(renderPass.commandBuffer.buffer);
+        frame.submitted = this->batcher.flush(context);
+        display.recordPresent();
+    }
+    //anything batched stays pending and goes out with the next real frame
+    else if(frame.acquired){
+        Semaphore & presentWait = this->renderFinished[frame.imageIndex];
+
+        renderPass.submitWork(this->batcher, frame.imageAvailable, presentWait);
+        frame.submitted = this->batcher.flush(context);
+        renderPass.submitPresentation(context, display, presentWait, frame.imageIndex);
+    }
+
+    //the frame a retirement waited for is out, it goes once that completes.
+    //frames thrown away while minimized never reach the queue and do not count
+    if(display.offscreen || frame.acquired){
+        size_t kept = 0;
+        for(size_t i = 0; i < this->awaitingFrame.size(); i++){
+            if(this->awaitingFrame[i].frameNumber <= this->submittedFrames){
+                this->retired.push(frame.submitted, std::move(this->awaitingFrame[i].destroy));
+            }
+            else{
+                if(kept != i){
+                    this->awaitingFrame[kept] = std::move(this->awaitingFrame[i]);
+                }
+                kept++;
+            }
+        }
+        this->awaitingFrame.resize(kept);
+        this->submittedFrames++;
+    }
+
+    this->current = (this->current + 1) % this->frames.size();
+    this->frameNumber++;
+}
+
+void FrameRing::waitForPending(Context & context){
+    for(auto & frame : this->frames){
+        context.wait(frame.submitted);
+    }
+}
+
+void FrameRing::retire(Context & context, std::function<void(Context &)> destroy){
+    this->retired.push(context.lastSubmitted(GRAPHICS_TIMELINE), destroy);
+}
+
+void FrameRing::destroy(Context & context){
+    this->retired.flush(context);
+    for(auto & frame : this->frames){
+        context.wait(frame.submitted);
+    }
+    //nothing is presented any more once every frame has retired
+    for(auto & retirement : this->awaitingFrame){
+        retirement.destroy(context);
+    }
+    this->awaitingFrame.clear();
+    for(auto & frame : this->frames){
+        frame.descriptors.destroy(context);
+        frame.commands.destroy(context);
+        vkDestroySemaphore(context.device, frame.imageAvailable.semaphore, nullptr);
+    }
+    for(auto & semaphore : this->renderFinished){
+        vkDestroySemaphore(context.device, semaphore.semaphore, nullptr);
+    }
+    this->frames.clear();
+    this->renderFinished.clear();
+}
+
+//=====================================================================
+//===============================PARALLEL RECORDING====================
+//=====================================================================
+
+//records a run of draws into a secondary that continues renderPass on the
+//framebuffer of imageIndex. shared by parallel slices and static bundles
+static void recordSecondaryDraws(VkCommandBuffer buffer, RenderPass & renderPass, uint32_t imageIndex, VkCommandBufferUsageFlags usage, const DrawCommand * draws, size_t count){
+    VkCommandBufferInheritanceInfo inheritanceInfo = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,      //sType
+        nullptr,                                                //pNext
+        renderPass.renderPass,                                  //renderPass
+        0,                                                      //subpass
+        renderPass.frameBuffers[imageIndex],                    //framebuffer
+        VK_FALSE,                                               //occlusionQueryEnable
+        0,                                                      //queryFlags
+        0                                                       //pipelineStatistics
+    };
+
+    VkCommandBufferBeginInfo commandBufferBeginCI = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,            //sType
+        nullptr,                                                //pNext
+        usage | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT, //flags
+        &inheritanceInfo                                        //pInheritanceInfo
+    };
+
+    if(vkBeginCommandBuffer(buffer, &commandBufferBeginCI) != VK_SUCCESS){
+        std::cout << "could not start secondary command buffer" << std::endl;
+        exit(1);
+    }
+
+    //secondaries inherit no state, so each one starts from nothing bound
+    //and sets the dynamic viewport itself
+    VkViewport viewport = {
+        0.0f,                                                       //x
+        0.0f,                                                       //y
+        static_cast<float>(renderPass.renderArea.extent.width),     //width
+        static_cast<float>(renderPass.renderArea.extent.height),    //height
+        0.0f,                                                       //minDepth
+        1.0f                                                        //maxDepth
+    };
+    CommandRecorder recorder;
+    recorder.begin(buffer);
+    recorder.setViewport(viewport);
+    recorder.setScissor(renderPass.renderArea);
+
+    for(size_t i = 0; i < count; i++){
+        const DrawCommand & draw = draws[i];
+        if(draw.pipeline == VK_NULL_HANDLE){
+            continue;
+        }
+        recorder.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, draw.pipeline);
+        recorder.bindVertexBuffer(0, draw.vertexBuffer);
+        recorder.bindIndexBuffer(draw.indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+        recorder.pushConstants(draw.layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, draw.drawData);
+        recorder.drawIndexed(draw.indexCount, 1, draw.firstIndex, draw.vertexOffset, 0);
+    }
+
+    if(vkEndCommandBuffer(buffer) != VK_SUCCESS){
+        std::cout << "could not record secondary command buffer" << std::endl;
+        exit(1);
+    }
+}
+
+void ParallelRecorder::init(Context & context, ThreadPool & threadPool, uint32_t framesInFlight, uint32_t sliceCount){
+    this->threadPool = &threadPool;
+    this->sliceCount = sliceCount == 0 ? threadPool.getThreadCount() : sliceCount;
+
+    this->allocators.resize(framesInFlight);
+    this->recorded.reserve(this->sliceCount);
+    for(auto & frameAllocators : this->allocators){
+        frameAllocators.resize(this->sliceCount);
+        for(auto & allocator : frameAllocators){
+            allocator.init(context);
+        }
+    }
+}
+
+const std::vector<VkCommandBuffer> & ParallelRecorder::record(Context & context, RenderPass & renderPass, uint32_t frameIndex, uint32_t imageIndex, const std::vector<DrawCommand> & draws){
+    std::vector<CommandAllocator> & frameAllocators = this->allocators[frameIndex];
+
+    //the frame ring already waited on this frame's token, so its pools are idle
+    for(auto & allocator : frameAllocators){
+        allocator.reset(context);
+    }
+
+    size_t sliceSize = (draws.size() + this->sliceCount - 1) / this->sliceCount;
+    this->recorded.clear();
+    //wait on just these slices, the pool may also be compiling pipelines
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    uint32_t remaining = 0;
+    for(uint32_t slice = 0; slice < this->sliceCount; slice++){
+        size_t first = slice * sliceSize;
+        if(first >= draws.size()){
+            break;
+        }
+        size_t count = std::min(sliceSize, draws.size() - first);
+        VkCommandBuffer buffer = frameAllocators[slice].allocate(context, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+        const DrawCommand * sliceDraws = draws.data() + first;
+
+        {
+            std::lock_guard<std::mutex> lock(doneMutex);
+            remaining++;
+        }
+        this->threadPool->submit([buffer, &renderPass, imageIndex, sliceDraws, count, &doneMutex, &doneCondition, &remaining]{
+            recordSecondaryDraws(buffer, renderPass, imageIndex, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, sliceDraws, count);
+            std::lock_guard<std::mutex> lock(doneMutex);
+            remaining--;
+            doneCondition.notify_one();
+        });
+        this->recorded.push_back(buffer);
+    }
+    {
+        std::unique_lock<std::mutex> lock(doneMutex);
+        doneCondition.wait(lock, [&remaining]{return remaining == 0;});
+    }
+
+    //in draw list order, for the primary to execute
+    return this->recorded;
+}
+
+void ParallelRecorder::destroy(Context & context){
+    for(auto & frameAllocators : this->allocators){
+        for(auto & allocator : frameAllocators){
+            allocator.destroy(context);
+        }
+    }
+    this->allocators.clear();
+    this->recorded.clear();
+}
+
+//=====================================================================
+//===============================STATIC BUNDLES========================
+//=====================================================================
+
+void StaticBundle::init(Context & context, RenderPass & renderPass){
+    this->createBuffers(context, renderPass);
+    this->dirty = true;
+}
+
+void StaticBundle::createBuffers(Context & context, RenderPass & renderPass){
+    VkCommandPoolCreateInfo commandPoolCI = {
+        VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,     //sType
+        nullptr,                                        //pNext
+        0,                                              //flags
+        context.queue.queueFamilyIndex                  //queueFamilyIndex
+    };
+
+    if(vkCreateCommandPool(context.device, &commandPoolCI, nullptr, &this->pool) != VK_SUCCESS){
+        std::cout << "could not create bundle command pool" << std::endl;
+        exit(1);
+    }
+
+    //one per swapchain image, each inherits its own framebuffer
+    this->buffers.resize(renderPass.frameBuffers.size());
+    VkCommandBufferAllocateInfo commandBufferAllocateI = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, //sType
+        nullptr,                                        //pNext
+        this->pool,                                     //commandPool
+        VK_COMMAND_BUFFER_LEVEL_SECONDARY,              //level
+        static_cast<uint32_t>(this->buffers.size())     //commandBufferCount
+    };
+
+    if(vkAllocateCommandBuffers(context.device, &commandBufferAllocateI, this->buffers.data()) != VK_SUCCESS){
+        std::cout << "could not allocate bundle command buffers" << std::endl;
+        exit(1);
+    }
+    this->framebufferGeneration = renderPass.framebufferGeneration;
+}
+
+void StaticBundle::setDraws(const std::vector<DrawCommand> & draws){
+    this->draws = draws;
+    this->dirty = true;
+}
+
+VkCommandBuffer StaticBundle::get(Context & context, FrameRing & frameRing, RenderPass & renderPass, uint32_t imageIndex){
+    if(this->dirty || this->framebufferGeneration != renderPass.framebufferGeneration){
+        //the old recording may still be pending in other frames, it goes
+        //with its pool once they retire and a fresh pool takes over
+        if(this->recordCount > 0 || this->framebufferGeneration != renderPass.framebufferGeneration){
+            VkCommandPool oldPool = this->pool;
+            frameRing.retire(context, [oldPool](Context & context){
+                vkDestroyCommandPool(context.device, oldPool, nullptr);
+            });
+            this->createBuffers(context, renderPass);
+        }
+
+        //simultaneous use, the same image can come back while its last frame
+        //is still executing
+        for(uint32_t i = 0; i < this->buffers.size(); i++){
+            recordSecondaryDraws(this->buffers[i], renderPass, i, VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT, this->draws.data(), this->draws.size());
+        }
+        this->dirty = false;
+        this->recordCount++;
+    }
+    return this->buffers[imageIndex];
+}
+
+void StaticBundle::destroy(Context & context){
+    vkDestroyCommandPool(context.device, this->pool, nullptr);
+    this->buffers.clear();
+    this->draws.clear();
+}
+
+//=====================================================================
+//===============================DRAW QUEUE============================
+//=====================================================================
+
+//below this many packets the pool handoff costs more than it saves
+static const size_t PARALLEL_SORT_THRESHOLD = 16384;
+
+void DrawQueue::init(ThreadPool * threadPool){
+    this->threadPool = threadPool;
+}
+
+uint64_t DrawQueue::makeKey(uint32_t pass, uint32_t pipeline, uint32_t mesh, float depth){
+    depth = std::min(std::max(depth, 0.0f), 1.0f);
+    uint64_t quantizedDepth = static_cast<uint64_t>(depth * ((1u << SORT_DEPTH_BITS) - 1) + 0.5f);
+
+    uint64_t key = pass & ((1u << SORT_PASS_BITS) - 1);
+    key = (key << SORT_PIPELINE_BITS) | (pipeline & ((1u << SORT_PIPELINE_BITS) - 1));
+    key = (key << SORT_MESH_BITS) | (mesh & ((1u << SORT_MESH_BITS) - 1));
+    key = (key << SORT_DEPTH_BITS) | quantizedDepth;
+    return key;
+}
+
+void DrawQueue::submit(uint64_t key, const DrawCommand & command){
+    DrawPacket packet = {
+        key,                                                    //key
+        static_cast<uint32_t>(this->commands.size()),           //command
+        0                                                       //padding
+    };
+    this->commands.push_back(command);
+    this->packets.push_back(packet);
+}
+
+uint64_t DrawQueue::varyingBits(){
+    //a key bit that is the same in every packet cannot change the order,
+    //and-ing and or-ing all keys finds them in one pass
+    uint64_t allSet = ~0ull;
+    uint64_t anySet = 0;
+    size_t i = 0;
+#ifdef RENDER_SSE2
+    __m128i andKeys = _mm_set1_epi32(-1);
+    __m128i orKeys = _mm_setzero_si128();
+    for(; i + 2 <= this->packets.size(); i += 2){
+        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&this->packets[i]));
+        __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&this->packets[i + 1]));
+        //low halves hold the keys
+        __m128i keys = _mm_unpacklo_epi64(first, second);
+        andKeys = _mm_and_si128(andKeys, keys);
+        orKeys = _mm_or_si128(orKeys, keys);
+    }
+    uint64_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), andKeys);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes + 2), orKeys);
+    allSet = lanes[0] & lanes[1];
+    anySet = lanes[2] | lanes[3];
+#endif
+    for(; i < this->packets.size(); i++){
+        allSet &= this->packets[i].key;
+        anySet |= this->packets[i].key;
+    }
+    return allSet ^ anySet;
+}
+
+void DrawQueue::forEachChunk(uint32_t chunkCount, const std::function<void(uint32_t, size_t, size_t)> & job){
+    size_t chunkSize = (this->packets.size() + chunkCount - 1) / chunkCount;
+    if(chunkCount == 1){
+        job(0, 0, this->packets.size());
+        return;
+    }
+
+    //wait on just these chunks, the pool may also be compiling pipelines.
+    //the last chunk runs here so the caller works instead of only waiting
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    uint32_t remaining = chunkCount - 1;
+    for(uint32_t chunk = 0; chunk + 1 < chunkCount; chunk++){
+        size_t first = std::min(chunk * chunkSize, this->packets.size());
+        size_t last = std::min(first + chunkSize, this->packets.size());
+        this->threadPool->submit([&job, chunk, first, last, &doneMutex, &doneCondition, &remaining]{
+            job(chunk, first, last);
+            std::lock_guard<std::mutex> lock(doneMutex);
+            remaining--;
+            doneCondition.notify_one();
+        });
+    }
+    size_t first = std::min((chunkCount - 1) * chunkSize, this->packets.size());
+    job(chunkCount - 1, first, this->packets.size());
+
+    std::unique_lock<std::mutex> lock(doneMutex);
+    doneCondition.wait(lock, [&remaining]{return remaining == 0;});
+}
+
+void DrawQueue::radixPass(uint32_t shift){
+    uint32_t chunkCount = 1;
+    if(this->threadPool != nullptr && this->threadPool->getThreadCount() > 1 && this->packets.size() >= PARALLEL_SORT_THRESHOLD){
+        chunkCount = this->threadPool->getThreadCount();
+    }
+    this->counts.assign(chunkCount * 256, 0);
+
+    const DrawPacket * source = this->packets.data();
+    DrawPacket * destination = this->scratch.data();
+    uint32_t * histograms = this->counts.data();
+
+    forEachChunk(chunkCount, [source, histograms, shift](uint32_t chunk, size_t first, size_t last){
+        uint32_t * histogram = histograms + chunk * 256;
+        for(size_t i = first; i < last; i++){
+            histogram[(source[i].key >> shift) & 0xFF]++;
+        }
+    });
+
+    //each chunk writes its share of a digit after the earlier chunks', which
+    //keeps the pass stable
+    uint32_t offset = 0;
+    for(uint32_t digit = 0; digit < 256; digit++){
+        for(uint32_t chunk = 0; chunk < chunkCount; chunk++){
+            uint32_t count = histograms[chunk * 256 + digit];
+            histograms[chunk * 256 + digit] = offset;
+            offset += count;
+        }
+    }
+
+    forEachChunk(chunkCount, [source, destination, histograms, shift](uint32_t chunk, size_t first, size_t last){
+        uint32_t * offsets = histograms + chunk * 256;
+        for(size_t i = first; i < last; i++){
+            destination[offsets[(source[i].key >> shift) & 0xFF]++] = source[i];
+        }
+    });
+
+    std::swap(this->packets, this->scratch);
+}
+
+void DrawQueue::sort(){
+    this->sortPasses = 0;
+    if(this->packets.size() < 2){
+        return;
+    }
+    this->scratch.resize(this->packets.size());
+
+    //least significant byte first, bytes no key differs in are skipped
+    uint64_t varying = this->varyingBits();
+    for(uint32_t shift = 0; shift < 64; shift += 8){
+        if(((varying >> shift) & 0xFF) == 0){
+            continue;
+        }
+        this->radixPass(shift);
+        this->sortPasses++;
+    }
+}
+
+void DrawQueue::replay(CommandRecorder & recorder){
+    //the recorder drops whatever the previous draw already bound, sorting
+    //is what makes those runs long
+    uint32_t issued = recorder.getIssued();
+    uint32_t dropped = recorder.getDropped();
+
+    for(auto & packet : this->packets){
+        const DrawCommand & draw = this->commands[packet.command];
+        if(draw.pipeline == VK_NULL_HANDLE){
+            continue;
+        }
+        recorder.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, draw.pipeline);
+        recorder.bindVertexBuffer(0, draw.vertexBuffer);
+        recorder.bindIndexBuffer(draw.indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+        recorder.pushConstants(draw.layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, draw.drawData);
+        recorder.drawIndexed(draw.indexCount, 1, draw.firstIndex, draw.vertexOffset, 0);
+    }
+
+    this->changesIssued = recorder.getIssued() - issued;
+    this->changesSaved = recorder.getDropped() - dropped;
+}
+
+void DrawQueue::clear(){
+    this->commands.clear();
+    this->packets.clear();
+}
+
+void DrawQueue::report(){
+    std::cout << "draw queue: " << this->packets.size() << " draws sorted in " << this->sortPasses << " radix passes" << std::endl;
+    std::cout << "draw queue: " << this->changesIssued << " state changes issued, " << this->changesSaved << " saved" << std::endl;
+}
+
+//=====================================================================
+//===============================ASYNC COMPUTE=========================
+//=====================================================================
+
+void AsyncCompute::init(Context & context, uint32_t framesInFlight){
+    this->allocators.resize(framesInFlight);
+    this->submitted.resize(framesInFlight);
+    for(uint32_t i = 0; i < framesInFlight; i++){
+        this->allocators[i].init(context, context.computeQueue.queueFamilyIndex);
+        this->submitted[i] = {};
+    }
+    this->current = 0;
+}
+
+VkCommandBuffer AsyncCompute::begin(Context & context){
+    //same recycling as the frame ring, on the compute timeline
+    context.wait(this->submitted[this->current]);
+    CommandAllocator & allocator = this->allocators[this->current];
+    allocator.reset(context);
+    VkCommandBuffer buffer = allocator.allocate(context, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+    VkCommandBufferBeginInfo commandBufferBeginCI = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,            //sType
+        nullptr,                                                //pNext
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,            //flags
+        nullptr                                                 //pInheritanceInfo
+    };
+
+    if(vkBeginCommandBuffer(buffer, &commandBufferBeginCI) != VK_SUCCESS){
+        std::cout << "could not start compute command buffer" << std::endl;
+        exit(1);
+    }
+    return buffer;
+}
+
+SyncToken AsyncCompute::submit(Context & context, VkCommandBuffer buffer, const SyncToken & waitFor, VkPipelineStageFlags2 waitStages){
+    if(vkEndCommandBuffer(buffer) != VK_SUCCESS){
+        std::cout << "could not record compute command buffer" << std::endl;
+        exit(1);
+    }
+
+    this->batcher.wait(context, waitFor, waitStages);
+    this->batcher.add(buffer);
+    SyncToken token = this->batcher.flush(context, COMPUTE_TIMELINE);
+
+    this->submitted[this->current] = token;
+    this->current = (this->current + 1) % this->allocators.size();
+    return token;
+}
+
+void AsyncCompute::destroy(Context & context){
+    for(uint32_t i = 0; i < this->allocators.size(); i++){
+        context.wait(this->submitted[i]);
+        this->allocators[i].destroy(context);
+    }
+    this->allocators.clear();
+    this->submitted.clear();
+}
+
+//=====================================================================
+//===============================STATE TRACKER=========================
+//=====================================================================
+
+void ResourceStateTracker::trackImage(VkImage image, VkImageAspectFlags aspect, uint32_t mipLevels, uint32_t arrayLayers, VkImageLayout layout, VkPipelineStageFlags2 stages){
+    TrackedImage & tracked = this->images[image];
+    tracked.aspect = aspect;
+    tracked.mipLevels = mipLevels;
+    tracked.arrayLayers = arrayLayers;
+    tracked.states.assign(mipLevels * arrayLayers, {layout, stages, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE});
+    tracked.pending.assign(mipLevels * arrayLayers, {});
+    tracked.dirty = false;
+}
+
+bool ResourceStateTracker::isTracked(VkImage image){
+    return this->images.find(image) != this->images.end();
+}
+
+void ResourceStateTracker::forgetImage(VkImage image){
+    this->images.erase(image);
+}
+
+void ResourceStateTracker::forgetBuffer(VkBuffer buffer){
+    this->buffers.erase(buffer);
+}
+
+void ResourceStateTracker::alias(VkImage image, VkImage previous){
+    //the new tenant only has to wait for the old one to finish with the memory
+    VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 access = VK_ACCESS_2_NONE;
+    auto found = this->images.find(previous);
+    if(found != this->images.end()){
+        for(auto & state : found->second.states){
+            stages |= state.writeStages | state.readStages;
+            access |= state.writeAccess;
+        }
+    }
+
+    for(auto & state : this->images.at(image).states){
+        state = {VK_IMAGE_LAYOUT_UNDEFINED, stages, access, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE};
+    }
+}
+
+bool ResourceStateTracker::apply(AccessState & state, PendingBarrier & pending, const ImageUse & use, bool isImage){
+    bool transition = isImage && use.layout != state.layout;
+
+    if(pending.active){
+        //already waiting on this transition point, widen what it covers
+        pending.dstStages |= use.stages;
+        pending.dstAccess |= use.access;
+        if(transition){
+            pending.newLayout = use.layout;
+        }
+    }else if(use.write || transition){
+        //write after anything, or a layout change, waits for every earlier
+        //access. a first write with no history needs nothing
+        if(transition || state.writeStages != 0 || state.readStages != 0){
+            pending = {true, state.writeStages | state.readStages, state.writeAccess, use.stages, use.access, state.layout, isImage ? use.layout : state.layout};
+        }
+    }else if(state.writeStages != 0 && ((use.stages & ~state.readStages) || (use.access & ~state.readAccess))){
+        //read after write, unless an earlier barrier already made it visible here
+        pending = {true, state.writeStages, state.writeAccess, use.stages, use.access, state.layout, state.layout};
+    }
+
+    if(use.write || transition){
+        //a transition is itself a write, later readers on other stages
+        //still have to wait for it
+        state.layout = isImage ? use.layout : state.layout;
+        state.writeStages = use.stages;
+        state.writeAccess = use.write ? use.access : VK_ACCESS_2_NONE;
+        state.readStages = use.write ? VK_PIPELINE_STAGE_2_NONE : use.stages;
+        state.readAccess = use.write ? VK_ACCESS_2_NONE : use.access;
+    }else{
+        state.readStages |= use.stages;
+        state.readAccess |= use.access;
+    }
+    return pending.active;
+}
+
+void ResourceStateTracker::useImage(VkImage image, const VkImageSubresourceRange & range, const ImageUse & use){
+    TrackedImage & tracked = this->images.at(image);
+    uint32_t mipCount = range.levelCount == VK_REMAINING_MIP_LEVELS ? tracked.mipLevels - range.baseMipLevel : range.levelCount;
+    uint32_t layerCount = range.layerCount == VK_REMAINING_ARRAY_LAYERS ? tracked.arrayLayers - range.baseArrayLayer : range.layerCount;
+    this->usesRequested++;
+
+    for(uint32_t mip = range.baseMipLevel; mip < range.baseMipLevel + mipCount; mip++){
+        for(uint32_t layer = range.baseArrayLayer; layer < range.baseArrayLayer + layerCount; layer++){
+            uint32_t index = mip * tracked.arrayLayers + layer;
+            if(apply(tracked.states[index], tracked.pending[index], use, true) && !tracked.dirty){
+                tracked.dirty = true;
+                this->dirtyImages.push_back(image);
+            }
+        }
+    }
+}
+
+void ResourceStateTracker::useImage(VkImage image, const ImageUse & use){
+    VkImageSubresourceRange range = {
+        0,                                                      //aspectMask
+        0,                                                      //baseMipLevel
+        VK_REMAINING_MIP_LEVELS,                                //levelCount
+        0,                                                      //baseArrayLayer
+        VK_REMAINING_ARRAY_LAYERS                               //layerCount
+    };
+    this->useImage(image, range, use);
+}
+
+void ResourceStateTracker::useBuffer(VkBuffer buffer, VkPipelineStageFlags2 stages, VkAccessFlags2 access, bool write){
+    //buffers are tracked whole and have no layout
+    TrackedBuffer & tracked = this->buffers[buffer];
+    this->usesRequested++;
+    if(apply(tracked.state, tracked.pending, {stages, access, VK_IMAGE_LAYOUT_UNDEFINED, write}, false) && !tracked.dirty){
+        tracked.dirty = true;
+        this->dirtyBuffers.push_back(buffer);
+    }
+}
+
+VkImageLayout ResourceStateTracker::getLayout(VkImage image, uint32_t mip, uint32_t layer){
+    TrackedImage & tracked = this->images.at(image);
+    return tracked.states[mip * tracked.arrayLayers + layer].layout;
+}
+
+bool ResourceStateTracker::samePending(const PendingBarrier & a, const PendingBarrier & b){
+    return a.srcStages == b.srcStages && a.srcAccess == b.srcAccess &&
+           a.dstStages == b.dstStages && a.dstAccess == b.dstAccess &&
+           a.oldLayout == b.oldLayout && a.newLayout == b.newLayout;
+}
+
+void ResourceStateTracker::flush(VkCommandBuffer commandBuffer){
+    this->imageBarriers.clear();
+    this->bufferBarriers.clear();
+
+    for(auto image : this->dirtyImages){
+        auto found = this->images.find(image);
+        if(found == this->images.end()){
+            continue;
+        }
+        TrackedImage & tracked = found->second;
+
+        //runs of layers with identical barriers within each mip
+        this->layerRuns.clear();
+        for(uint32_t mip = 0; mip < tracked.mipLevels; mip++){
+            for(uint32_t layer = 0; layer < tracked.arrayLayers; layer++){
+                const PendingBarrier & pending = tracked.pending[mip * tracked.arrayLayers + layer];
+                if(!pending.active){
+                    continue;
+                }
+                if(!this->layerRuns.empty()){
+                    PendingRange & run = this->layerRuns.back();
+                    if(run.mip == mip && run.layer + run.layerCount == layer && samePending(*run.barrier, pending)){
+                        run.layerCount++;
+                        continue;
+                    }
+                }
+                this->layerRuns.push_back({mip, 1, layer, 1, &pending});
+            }
+        }
+
+        //then stack equal runs of consecutive mips into one range
+        this->ranges.clear();
+        for(auto & run : this->layerRuns){
+            bool merged = false;
+            for(auto & range : this->ranges){
+                if(range.mip + range.mipCount == run.mip && range.layer == run.layer && range.layerCount == run.layerCount &&
+                   samePending(*range.barrier, *run.barrier)){
+                    range.mipCount++;
+                    merged = true;
+                    break;
+                }
+            }
+            if(!merged){
+                this->ranges.push_back(run);
+            }
+        }
+
+        for(auto & range : this->ranges){
+            const PendingBarrier & pending = *range.barrier;
+            this->imageBarriers.push_back({
+                VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,               //sType
+                nullptr,                                                //pNext
+                pending.srcStages,                                      //srcStageMask
+                pending.srcAccess,                                      //srcAccessMask
+                pending.dstStages,                                      //dstStageMask
+                pending.dstAccess,                                      //dstAccessMask
+                pending.oldLayout,                                      //oldLayout
+                pending.newLayout,                                      //newLayout
+                VK_QUEUE_FAMILY_IGNORED,                                //srcQueueFamilyIndex
+                VK_QUEUE_FAMILY_IGNORED,                                //dstQueueFamilyIndex
+                image,                                                  //image
+                {tracked.aspect, range.mip, range.mipCount, range.layer, range.layerCount} //subresourceRange
+            });
+        }
+        for(auto & pending : tracked.pending){
+            pending.active = false;
+        }
+        tracked.dirty = false;
+    }
+
+    for(auto buffer : this->dirtyBuffers){
+        auto found = this->buffers.find(buffer);
+        if(found == this->buffers.end()){
+            continue;
+        }
+        TrackedBuffer & tracked = found->second;
+        this->bufferBarriers.push_back({
+            VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,                  //sType
+            nullptr,                                                    //pNext
+            tracked.pending.srcStages,                                  //srcStageMask
+            tracked.pending.srcAccess,                                  //srcAccessMask
+            tracked.pending.dstStages,                                  //dstStageMask
+            tracked.pending.dstAccess,                                  //dstAccessMask
+            VK_QUEUE_FAMILY_IGNORED,                                    //srcQueueFamilyIndex
+            VK_QUEUE_FAMILY_IGNORED,                                    //dstQueueFamilyIndex
+            buffer,                                                     //buffer
+            0,                                                          //offset
+            VK_WHOLE_SIZE                                               //size
+        });
+        tracked.pending.active = false;
+        tracked.dirty = false;
+    }
+    this->dirtyImages.clear();
+    this->dirtyBuffers.clear();
+
+    if(this->imageBarriers.empty() && this->bufferBarriers.empty()){
+        return;
+    }
+
+    VkDependencyInfo dependencyInfo = {
+        VK_STRUCTURE_TYPE_DEPENDENCY_INFO,                              //sType
+        nullptr,                                                        //pNext
+        0,                                                              //dependencyFlags
+        0,                                                              //memoryBarrierCount
+        nullptr,                                                        //pMemoryBarriers
+        static_cast<uint32_t>(this->bufferBarriers.size()),             //bufferMemoryBarrierCount
+        this->bufferBarriers.data(),                                    //pBufferMemoryBarriers
+        static_cast<uint32_t>(this->imageBarriers.size()),              //imageMemoryBarrierCount
+        this->imageBarriers.data()                                      //pImageMemoryBarriers
+    };
+    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+    this->barriersIssued += this->imageBarriers.size() + this->bufferBarriers.size();
+    this->batchesIssued++;
+}
+
+void ResourceStateTracker::report(){
+    std::cout << "state tracker: " << this->usesRequested << " uses needed " << this->barriersIssued
+              << " barriers in " << this->batchesIssued << " batches" << std::endl;
+}
+
+//=====================================================================
+//===============================RENDER GRAPH==========================
+//=====================================================================
+
+struct GraphUsageState{
+    VkPipelineStageFlags2 stages;
+    VkAccessFlags2 access;
+    VkImageLayout layout;
+    VkImageUsageFlags imageUsage;
+};
+
+static GraphUsageState graphUsageState(GraphUsage usage, VkPipelineStageFlags2 shaderStages){
+    switch(usage){
+        case GRAPH_COLOR_ATTACHMENT:
+            return {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                    VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT};
+        case GRAPH_DEPTH_ATTACHMENT:
+            return {VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                    VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT};
+        case GRAPH_SAMPLED:
+            return {shaderStages, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT};
+        case GRAPH_STORAGE_READ:
+            return {shaderStages, VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
+                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT};
+        case GRAPH_STORAGE_WRITE:
+            return {shaderStages, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT};
+        case GRAPH_TRANSFER_SRC:
+            return {VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT,
+                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT};
+        case GRAPH_TRANSFER_DST:
+            return {VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT};
+        case GRAPH_INDIRECT:
+            return {VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT,
+                    VK_IMAGE_LAYOUT_UNDEFINED, 0};
+        case GRAPH_VERTEX_INPUT:
+            return {VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT,
+                    VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT,
+                    VK_IMAGE_LAYOUT_UNDEFINED, 0};
+    }
+    return {VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED, 0};
+}
+
+static VkImageAspectFlags aspectForFormat(VkFormat format){
+    switch(format){
+        case VK_FORMAT_D16_UNORM:
+        case VK_FORMAT_X8_D24_UNORM_PACK32:
+        case VK_FORMAT_D32_SFLOAT:
+            return VK_IMAGE_ASPECT_DEPTH_BIT;
+        case VK_FORMAT_D16_UNORM_S8_UINT:
+        case VK_FORMAT_D24_UNORM_S8_UINT:
+        case VK_FORMAT_D32_SFLOAT_S8_UINT:
+            return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+        default:
+            return VK_IMAGE_ASPECT_COLOR_BIT;
+    }
+}
+
+GraphResource RenderGraph::createImage(const GraphImageDesc & desc){
+    Resource resource = {};
+    resource.isImage = true;
+    resource.desc = desc;
+    resource.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    resource.finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    resource.slot = -1;
+    this->resources.push_back(resource);
+    this->compiled = false;
+    return static_cast<GraphResource>(this->resources.size() - 1);
+}
+
+GraphResource RenderGraph::importImage(VkImage image, VkImageView imageView, VkFormat format, VkImageLayout initialLayout, VkPipelineStageFlags2 initialStages, VkImageLayout finalLayout){
+    //whatever is written to an imported image is visible outside the graph
+    Resource resource = {};
+    resource.isImage = true;
+    resource.imported = true;
+    resource.output = true;
+    resource.desc.format = format;
+    resource.image = image;
+    resource.imageView = imageView;
+    resource.initialLayout = initialLayout;
+    resource.initialStages = initialStages;
+    resource.finalLayout = finalLayout;
+    resource.slot = -1;
+    this->resources.push_back(resource);
+    this->compiled = false;
+    return static_cast<GraphResource>(this->resources.size() - 1);
+}
+
+GraphResource RenderGraph::importBuffer(VkBuffer buffer){
+    Resource resource = {};
+    resource.imported = true;
+    resource.output = true;
+    resource.buffer = buffer;
+    resource.slot = -1;
+    this->resources.push_back(resource);
+    this->compiled = false;
+    return static_cast<GraphResource>(this->resources.size() - 1);
+}
+
+void RenderGraph::setImportedImage(GraphResource resource, VkImage image, VkImageView imageView){
+    this->resources[resource].image = image;
+    this->resources[resource].imageView = imageView;
+}
+
+void RenderGraph::setImportedBuffer(GraphResource resource, VkBuffer buffer){
+    this->resources[resource].buffer = buffer;
+}
+
+uint32_t RenderGraph::addPass(const std::string & name, std::function<void(VkCommandBuffer, RenderGraph &)> record, VkPipelineStageFlags2 shaderStages){
+    Pass pass = {};
+    pass.name = name;
+    pass.record = record;
+    pass.shaderStages = shaderStages;
+    this->passes.push_back(pass);
+    this->compiled = false;
+    return static_cast<uint32_t>(this->passes.size() - 1);
+}
+
+void RenderGraph::read(uint32_t pass, GraphResource resource, GraphUsage usage){
+    this->passes[pass].accesses.push_back({resource, usage, false});
+    this->resources[resource].usage |= graphUsageState(usage, 0).imageUsage;
+    this->compiled = false;
+}
+
+void RenderGraph::write(uint32_t pass, GraphResource resource, GraphUsage usage){
+    this->passes[pass].accesses.push_back({resource, usage, true});
+    this->resources[resource].usage |= graphUsageState(usage, 0).imageUsage;
+    this->compiled = false;
+}
+
+void RenderGraph::markOutput(GraphResource resource){
+    this->resources[resource].output = true;
+    this->compiled = false;
+}
+
+void RenderGraph::cull(){
+    //walk backwards from the outputs, a pass survives if something needed
+    //later reads what it writes
+    std::vector<bool> needed(this->resources.size());
+    for(size_t i = 0; i < this->resources.size(); i++){
+        needed[i] = this->resources[i].output;
+    }
+
+    for(size_t p = this->passes.size(); p-- > 0;){
+        Pass & pass = this->passes[p];
+        pass.alive = false;
+        for(auto & access : pass.accesses){
+            if(access.write && needed[access.resource]){
+                pass.alive = true;
+            }
+        }
+        if(!pass.alive){
+            continue;
+        }
+        for(auto & access : pass.accesses){
+            if(!access.write){
+                needed[access.resource] = true;
+            }
+        }
+    }
+}
+
+void RenderGraph::schedule(){
+    //a pass sits one level after everything it has a hazard with. passes on
+    //the same level never conflict, so they share one barrier batch
+    struct Tracking{
+        int lastWriter;
+        std::vector<uint32_t> readers;
+        VkImageLayout readLayout;
+    };
+    std::vector<Tracking> tracking(this->resources.size(), {-1, {}, VK_IMAGE_LAYOUT_UNDEFINED});
+
+    uint32_t levelCount = 0;
+    for(uint32_t p = 0; p < this->passes.size(); p++){
+        Pass & pass = this->passes[p];
+        if(!pass.alive){
+            continue;
+        }
+
+        uint32_t level = 0;
+        for(auto & access : pass.accesses){
+            Tracking & track = tracking[access.resource];
+            VkImageLayout layout = graphUsageState(access.usage, pass.shaderStages).layout;
+            if(track.lastWriter >= 0 && track.lastWriter != static_cast<int>(p)){
+                level = std::max(level, this->passes[track.lastWriter].level + 1);
+            }
+            //writing, or moving the image out from under earlier readers
+            bool transition = this->resources[access.resource].isImage && layout != track.readLayout;
+            if(access.write || (transition && !track.readers.empty())){
+                for(auto reader : track.readers){
+                    if(reader != p){
+                        level = std::max(level, this->passes[reader].level + 1);
+                    }
+                }
+            }
+        }
+        pass.level = level;
+        levelCount = std::max(levelCount, level + 1);
+
+        for(auto & access : pass.accesses){
+            if(access.write){
+                continue;
+            }
+            Tracking & track = tracking[access.resource];
+            VkImageLayout layout = graphUsageState(access.usage, pass.shaderStages).layout;
+            if(layout != track.readLayout){
+                track.readers.clear();
+            }
+            track.readers.push_back(p);
+            track.readLayout = layout;
+        }
+        for(auto & access : pass.accesses){
+            if(!access.write){
+                continue;
+            }
+            Tracking & track = tracking[access.resource];
+            track.lastWriter = static_cast<int>(p);
+            track.readers.clear();
+            track.readLayout = graphUsageState(access.usage, pass.shaderStages).layout;
+        }
+    }
+
+    //declaration order within a level keeps recording deterministic
+    this->order.clear();
+    for(uint32_t p = 0; p < this->passes.size(); p++){
+        if(this->passes[p].alive){
+            this->order.push_back(p);
+        }
+    }
+    std::stable_sort(this->order.begin(), this->order.end(), [this](uint32_t a, uint32_t b){
+        return this->passes[a].level < this->passes[b].level;
+    });
+
+    this->levelStart.assign(levelCount + 1, static_cast<uint32_t>(this->order.size()));
+    for(uint32_t i = this->order.size(); i-- > 0;){
+        this->levelStart[this->passes[this->order[i]].level] = i;
+    }
+
+    //lifetimes in levels, which is the granularity memory can be reused at
+    for(auto & resource : this->resources){
+        resource.firstLevel = -1;
+        resource.lastLevel = -1;
+    }
+    for(auto p : this->order){
+        int level = static_cast<int>(this->passes[p].level);
+        for(auto & access : this->passes[p].accesses){
+            Resource & resource = this->resources[access.resource];
+            if(resource.firstLevel < 0 || level < resource.firstLevel){
+                resource.firstLevel = level;
+            }
+            resource.lastLevel = std::max(resource.lastLevel, level);
+        }
+    }
+}
+
+void RenderGraph::allocateTransients(Context & context){
+    std::vector<GraphResource> transients;
+    std::vector<VkMemoryRequirements> requirements(this->resources.size());
+
+    for(GraphResource r = 0; r < this->resources.size(); r++){
+        Resource & resource = this->resources[r];
+        if(!resource.isImage || resource.imported || resource.firstLevel < 0){
+            continue;
+        }
+
+        VkImageCreateInfo imageCI = {
+            VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,                //sType
+            nullptr,                                            //pNext
+            0,                                                  //flags
+            VK_IMAGE_TYPE_2D,                                   //imageType
+            resource.desc.format,                               //format
+            {resource.desc.width, resource.desc.height, 1},     //extent
+            1,                                                  //mipLevels
+            1,                                                  //arrayLayers
+            VK_SAMPLE_COUNT_1_BIT,                              //samples
+            VK_IMAGE_TILING_OPTIMAL,                            //tiling
+            resource.usage,                                     //usage
+            VK_SHARING_MODE_EXCLUSIVE,                          //sharingMode
+            0,                                                  //queueFamilyIndexCount
+            nullptr,                                            //pQueueFamilyIndices
+            VK_IMAGE_LAYOUT_UNDEFINED                           //initialLayout
+        };
+
+        if(vkCreateImage(context.device, &imageCI, nullptr, &resource.image) != VK_SUCCESS){
+            std::cout << "could not create render graph image" << std::endl;
+            exit(1);
+        }
+        vkGetImageMemoryRequirements(context.device, resource.image, &requirements[r]);
+        this->transientBytes += requirements[r].size;
+        transients.push_back(r);
+    }
+
+    //biggest first, each image joins the first slot whose residents are all
+    //dead before it starts or born after it ends
+    std::sort(transients.begin(), transients.end(), [&requirements](GraphResource a, GraphResource b){
+        return requirements[a].size > requirements[b].size;
+    });
+    for(auto r : transients){
+        Resource & resource = this->resources[r];
+        int chosen = -1;
+        for(size_t i = 0; i < this->slots.size() && chosen < 0; i++){
+            MemorySlot & slot = this->slots[i];
+            if((slot.memoryTypeBits & requirements[r].memoryTypeBits) == 0){
+                continue;
+            }
+            bool overlaps = false;
+            for(auto resident : slot.residents){
+                Resource & other = this->resources[resident];
+                if(!(other.lastLevel < resource.firstLevel || resource.lastLevel < other.firstLevel)){
+                    overlaps = true;
+                    break;
+                }
+            }
+            if(!overlaps){
+                chosen = static_cast<int>(i);
+            }
+        }
+        if(chosen < 0){
+            this->slots.push_back({VK_NULL_HANDLE, 0, requirements[r].memoryTypeBits, {}});
+            chosen = static_cast<int>(this->slots.size() - 1);
+        }
+
+        MemorySlot & slot = this->slots[chosen];
+        slot.size = std::max(slot.size, requirements[r].size);
+        slot.memoryTypeBits &= requirements[r].memoryTypeBits;
+        slot.residents.push_back(r);
+        resource.slot = chosen;
+    }
+
+    for(auto & slot : this->slots){
+        std::sort(slot.residents.begin(), slot.residents.end(), [this](GraphResource a, GraphResource b){
+            return this->resources[a].firstLevel < this->resources[b].firstLevel;
+        });
+
+        VkMemoryAllocateInfo memoryAI = {
+            VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,             //sType
+            nullptr,                                            //pNext
+            slot.size,                                          //allocationSize
+            context.findMemoryType(slot.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) //memoryTypeIndex
+        };
+
+        if(vkAllocateMemory(context.device, &memoryAI, nullptr, &slot.memory) != VK_SUCCESS){
+            std::cout << "could not allocate render graph memory" << std::endl;
+            exit(1);
+        }
+
+        for(auto r : slot.residents){
+            Resource & resource = this->resources[r];
+            vkBindImageMemory(context.device, resource.image, slot.memory, 0);
+
+            VkImageViewCreateInfo imageViewCI = {
+                VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,       //sType
+                nullptr,                                        //pNext
+                0,                                              //flags
+                resource.image,                                 //image
+                VK_IMAGE_VIEW_TYPE_2D,                          //viewType
+                resource.desc.format,                           //format
+                {},                                             //components
+                {aspectForFormat(resource.desc.format), 0, 1, 0, 1} //subresourceRange
+            };
+
+            if(vkCreateImageView(context.device, &imageViewCI, nullptr, &resource.imageView) != VK_SUCCESS){
+                std::cout << "could not create render graph image view" << std::endl;
+                exit(1);
+            }
+        }
+    }
+}
+
+GraphResource RenderGraph::previousTenant(GraphResource resource){
+    //the first tenant of a slot follows the last one of the previous frame
+    std::vector<GraphResource> & residents = this->slots[this->resources[resource].slot].residents;
+    size_t position = std::find(residents.begin(), residents.end(), resource) - residents.begin();
+    return position > 0 ? residents[position - 1] : residents.back();
+}
+
+void RenderGraph::compile(Context & context){
+    if(this->compiled){
+        return;
+    }
+    this->destroy(context);
+
+    this->cull();
+    this->schedule();
+    this->allocateTransients(context);
+    this->compiled = true;
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer, ResourceStateTracker & tracker){
+    for(auto image : this->staleImages){
+        tracker.forgetImage(image);
+    }
+    this->staleImages.clear();
+
+    //imported images start every execution in their declared state
+    for(auto & resource : this->resources){
+        if(resource.imported && resource.isImage && resource.image != VK_NULL_HANDLE){
+            tracker.trackImage(resource.image, aspectForFormat(resource.desc.format), 1, 1, resource.initialLayout, resource.initialStages);
+        }
+    }
+    this->aliased.assign(this->resources.size(), false);
+
+    uint32_t levelCount = this->levelStart.empty() ? 0 : static_cast<uint32_t>(this->levelStart.size() - 1);
+    for(uint32_t level = 0; level < levelCount; level++){
+        for(uint32_t i = this->levelStart[level]; i < this->levelStart[level + 1]; i++){
+            Pass & pass = this->passes[this->order[i]];
+            for(auto & access : pass.accesses){
+                Resource & resource = this->resources[access.resource];
+                GraphUsageState state = graphUsageState(access.usage, pass.shaderStages);
+                if(!resource.isImage){
+                    tracker.useBuffer(resource.buffer, state.stages, state.access, access.write);
+                    continue;
+                }
+
+                if(!resource.imported && !this->aliased[access.resource]){
+                    if(!tracker.isTracked(resource.image)){
+                        tracker.trackImage(resource.image, aspectForFormat(resource.desc.format), 1, 1, VK_IMAGE_LAYOUT_UNDEFINED);
+                    }
+                    tracker.alias(resource.image, this->resources[this->previousTenant(access.resource)].image);
+                    this->aliased[access.resource] = true;
+                }
+                tracker.useImage(resource.image, {state.stages, state.access, state.layout, access.write});
+            }
+        }
+        tracker.flush(commandBuffer);
+
+        for(uint32_t i = this->levelStart[level]; i < this->levelStart[level + 1]; i++){
+            Pass & pass = this->passes[this->order[i]];
+            pass.record(commandBuffer, *this);
+        }
+    }
+
+    //hand imported images back in the layout the outside world expects
+    for(auto & resource : this->resources){
+        if(resource.imported && resource.isImage && resource.finalLayout != VK_IMAGE_LAYOUT_UNDEFINED){
+            tracker.useImage(resource.image, {VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_NONE, resource.finalLayout, false});
+        }
+    }
+    tracker.flush(commandBuffer);
+}
+
+void RenderGraph::report(){
+    VkDeviceSize allocated = 0;
+    for(auto & slot : this->slots){
+        allocated += slot.size;
+    }
+
+    std::cout << "render graph: " << this->order.size() << " of " << this->passes.size() << " passes live in "
+              << (this->levelStart.empty() ? 0 : this->levelStart.size() - 1) << " levels" << std::endl;
+    std::cout << "render graph: " << this->transientBytes / 1024 << " KiB of transients in "
+              << allocated / 1024 << " KiB across " << this->slots.size() << " allocations" << std::endl;
+}
+
+void RenderGraph::destroy(Context & context){
+    for(auto & resource : this->resources){
+        if(resource.imported || !resource.isImage){
+            continue;
+        }
+        if(resource.imageView != VK_NULL_HANDLE){
+            vkDestroyImageView(context.device, resource.imageView, nullptr);
+        }
+        if(resource.image != VK_NULL_HANDLE){
+            vkDestroyImage(context.device, resource.image, nullptr);
+            this->staleImages.push_back(resource.image);
+        }
+        resource.image = VK_NULL_HANDLE;
+        resource.imageView = VK_NULL_HANDLE;
+        resource.slot = -1;
+    }
+    for(auto & slot : this->slots){
+        vkFreeMemory(context.device, slot.memory, nullptr);
+    }
+    this->slots.clear();
+    this->transientBytes = 0;
+    this->compiled = false;
+}
+
+//=====================================================================
+//===============================GEOMETRYARENA=========================
+//=====================================================================
+
+void GeometryArena::init(Context & context, uint32_t maxVertices, uint32_t maxIndices, uint32_t maxMeshes){
+    this->maxVertices = maxVertices;
+    this->maxIndices = maxIndices;
+    this->maxMeshes = maxMeshes;
+
+    VkMemoryPropertyFlags hostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    this->vertices.init(context, sizeof(Vertex) * maxVertices, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_SHARING_MODE_EXCLUSIVE, hostVisible);
+    this->indices.init(context, sizeof(uint16_t) * maxIndices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_SHARING_MODE_EXCLUSIVE, hostVisible);
+    this->meshTable.init(context, sizeof(MeshRange) * maxMeshes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_SHARING_MODE_EXCLUSIVE, hostVisible);
+}
+
+uint32_t GeometryArena::addMesh(Context & context, const std::vector<Vertex> & meshVertices, const std::vector<uint16_t> & meshIndices){
+    if(this->vertexCount + meshVertices.size() > this->maxVertices ||
+       this->indexCount + meshIndices.size() > this->maxIndices ||
+       this->meshes.size() >= this->maxMeshes){
+        std::cout << "geometry arena is full" << std::endl;
+        exit(1);
+    }
+
+    //indices stay local to the mesh, vertexOffset rebases them
+    MeshRange range = {
+        this->indexCount,                                       //firstIndex
+        static_cast<uint32_t>(meshIndices.size()),              //indexCount
+        static_cast<int32_t>(this->vertexCount),                //vertexOffset
+        0                                                       //padding
+    };
+
+    this->vertices.write(context, meshVertices.data(), sizeof(Vertex) * this->vertexCount, sizeof(Vertex) * meshVertices.size());
+    this->indices.write(context, meshIndices.data(), sizeof(uint16_t) * this->indexCount, sizeof(uint16_t) * meshIndices.size());
+    this->meshTable.write(context, &range, sizeof(MeshRange) * this->meshes.size(), sizeof(MeshRange));
+
+    this->vertexCount += static_cast<uint32_t>(meshVertices.size());
+    this->indexCount += static_cast<uint32_t>(meshIndices.size());
+    this->meshes.push_back(range);
+    return static_cast<uint32_t>(this->meshes.size() - 1);
+}
+
+void GeometryArena::bind(CommandRecorder & recorder){
+    recorder.bindVertexBuffer(0, this->vertices.getBuffer());
+    recorder.bindIndexBuffer(this->indices.getBuffer(), 0, VK_INDEX_TYPE_UINT16);
+}
+
+void GeometryArena::destroy(Context & context){
+    this->vertices.destroy(context);
+    this->indices.destroy(context);
+    this->meshTable.destroy(context);
+    this->meshes.clear();
+    this->vertexCount = 0;
+    this->indexCount = 0;
+}
+
+//=====================================================================
+//===============================INDIRECTRENDERER======================
+//=====================================================================
+
+void IndirectRenderer::init(Context & context, GeometryArena & arena, RenderPass & renderPass, Display & display, uint32_t maxObjects,
+                            const std::string & cullShader, const std::string & vertexShader, const std::string & fragmentShader){
+    //compacted commands need more than one draw per call and carry the
+    //object id in firstInstance
+    if(!context.features.multiDrawIndirect || !context.features.drawIndirectFirstInstance){
+        std::cout << "device does not support gpu driven indirect drawing" << std::endl;
+        exit(1);
+    }
+    this->arena = &arena;
+    this->maxObjects = maxObjects;
+    this->indirectCountSupported = context.features12.drawIndirectCount;
+
+    this->objects.init(context, sizeof(GpuObject) * maxObjects, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_SHARING_MODE_EXCLUSIVE,
+                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    //culling may run on the async compute queue and hand its output to
+    //graphics, so the culled commands are shared by both families
+    this->commands.init(context, sizeof(VkDrawIndexedIndirectCommand) * maxObjects,
+                        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_SHARING_MODE_CONCURRENT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    this->count.init(context, sizeof(uint32_t),
+                     VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                     VK_SHARING_MODE_CONCURRENT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    //objects, mesh table, commands, count
+    this->setLayout.addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT);
+    this->setLayout.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+    this->setLayout.addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+    this->setLayout.addBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT);
+    this->setLayout.init(context);
+
+    std::vector<DescriptorWrite> writes = {
+        {0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, {this->objects.getBuffer(), 0, VK_WHOLE_SIZE}, {}},
+        {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, {arena.getMeshTable(), 0, VK_WHOLE_SIZE}, {}},
+        {2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, {this->commands.getBuffer(), 0, VK_WHOLE_SIZE}, {}},
+        {3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, {this->count.getBuffer(), 0, VK_WHOLE_SIZE}, {}}
+    };
+    this->set = this->descriptors.getSet(context, this->setLayout.layout, writes);
+
+    PipelineBuilder cullBuilder;
+    cullBuilder.setShader(context, VK_SHADER_STAGE_COMPUTE_BIT, cullShader, "main");
+    cullBuilder.addDescriptorSetLayout(this->setLayout.layout);
+    cullBuilder.setPushConstants<CullConstants>(VK_SHADER_STAGE_COMPUTE_BIT);
+    cullBuilder.setPipelineLayout(context);
+    this->cullPipeline = cullBuilder.createComputePipeline(context);
+    this->cullLayout = cullBuilder.getPipelineLayout();
+    cullBuilder.releaseShaderModules(context);
+
+    PipelineBuilder drawBuilder;
+    drawBuilder.setShader(context, VK_SHADER_STAGE_VERTEX_BIT, vertexShader, "main");
+    drawBuilder.setShader(context, VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShader, "main");
+    drawBuilder.setInputAssembly(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    drawBuilder.setVertexInputState();
+    drawBuilder.setTessellationState();
+    drawBuilder.setViewportState(display.viewport, display.defaultScissor);
+    drawBuilder.setRasterizationState(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE, 1.0f);
+    drawBuilder.setMultisampleState();
+    drawBuilder.setColorblendState();
+    drawBuilder.addDescriptorSetLayout(this->setLayout.layout);
+    drawBuilder.setPushConstants<glm::mat4>(VK_SHADER_STAGE_VERTEX_BIT);
+    drawBuilder.setPipelineLayout(context);
+    this->drawPipeline = drawBuilder.createPipeline(context, renderPass);
+    this->drawLayout = drawBuilder.getPipelineLayout();
+    drawBuilder.releaseShaderModules(context);
+}
+
+void IndirectRenderer::setObjects(Context & context, const std::vector<GpuObject> & objectList){
+    if(objectList.size() > this->maxObjects){
+        std::cout << "too many objects for the indirect renderer" << std::endl;
+        exit(1);
+    }
+    if(!objectList.empty()){
+        this->objects.write(context, objectList.data(), 0, sizeof(GpuObject) * objectList.size());
+    }
+    this->objectCount = static_cast<uint32_t>(objectList.size());
+}
+
+void IndirectRenderer::extractFrustum(const glm::mat4 & viewProjection, glm::vec4 planes[6]){
+    //planes from the rows of the clip matrix, glm is column major. depth is
+    //0 to 1 so the near plane is the z row alone
+    glm::vec4 rows[4];
+    for(int i = 0; i < 4; i++){
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    }
+    planes[0] = rows[3] + rows[0];  //left
+    planes[1] = rows[3] - rows[0];  //right
+    planes[2] = rows[3] + rows[1];  //top
+    planes[3] = rows[3] - rows[1];  //bottom
+    planes[4] = rows[2];            //near
+    planes[5] = rows[3] - rows[2];  //far
+
+    //normalized so the sphere test compares real distances
+    for(int i = 0; i < 6; i++){
+        float length = glm::length(glm::vec3(planes[i]));
+        if(length > 0.0f){
+            planes[i] /= length;
+        }
+    }
+}
+
+void IndirectRenderer::cull(CommandRecorder & recorder, ResourceStateTracker & tracker, const glm::mat4 & viewProjection){
+    VkCommandBuffer commandBuffer = recorder.get();
+    //the count restarts every frame. without a gpu count every slot is
+    //drawn, so the stale ones are cleared to zero instances
+    tracker.useBuffer(this->count.getBuffer(), VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, true);
+    if(!this->indirectCountSupported){
+        tracker.useBuffer(this->commands.getBuffer(), VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, true);
+    }
+    tracker.flush(commandBuffer);
+    vkCmdFillBuffer(commandBuffer, this->count.getBuffer(), 0, VK_WHOLE_SIZE, 0);
+    if(!this->indirectCountSupported){
+        vkCmdFillBuffer(commandBuffer, this->commands.getBuffer(), 0, VK_WHOLE_SIZE, 0);
+    }
+
+    if(this->objectCount > 0){
+        tracker.useBuffer(this->count.getBuffer(), VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, true);
+        tracker.useBuffer(this->commands.getBuffer(), VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, true);
+        tracker.flush(commandBuffer);
+
+        CullConstants constants = {};
+        extractFrustum(viewProjection, constants.planes);
+        constants.objectCount = this->objectCount;
+
+        recorder.bindPipeline(VK_PIPELINE_BIND_POINT_COMPUTE, this->cullPipeline);
+        recorder.bindDescriptorSet(VK_PIPELINE_BIND_POINT_COMPUTE, this->cullLayout, 0, this->set);
+        recorder.pushConstants(this->cullLayout, VK_SHADER_STAGE_COMPUTE_BIT, constants);
+        //64 wide groups, matches local_size_x in cull.comp
+        vkCmdDispatch(commandBuffer, (this->objectCount + 63) / 64, 1, 1);
+    }
+
+    tracker.useBuffer(this->count.getBuffer(), VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT, false);
+    tracker.useBuffer(this->commands.getBuffer(), VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT, false);
+    tracker.flush(commandBuffer);
+}
+
+void IndirectRenderer::draw(CommandRecorder & recorder, const glm::mat4 & viewProjection){
+    VkCommandBuffer commandBuffer = recorder.get();
+    recorder.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, this->drawPipeline);
+    recorder.bindDescriptorSet(VK_PIPELINE_BIND_POINT_GRAPHICS, this->drawLayout, 0, this->set);
+    recorder.pushConstants(this->drawLayout, VK_SHADER_STAGE_VERTEX_BIT, viewProjection);
+    this->arena->bind(recorder);
+
+    if(this->indirectCountSupported){
+        vkCmdDrawIndexedIndirectCount(commandBuffer, this->commands.getBuffer(), 0, this->count.getBuffer(), 0,
+                                      this->maxObjects, sizeof(VkDrawIndexedIndirectCommand));
+    }
+    else{
+        //culled slots were cleared to zero instances and cost next to nothing
+        vkCmdDrawIndexedIndirect(commandBuffer, this->commands.getBuffer(), 0, this->objectCount, sizeof(VkDrawIndexedIndirectCommand));
+    }
+}
+
+void IndirectRenderer::destroy(Context & context){
+    vkDestroyPipeline(context.device, this->cullPipeline, nullptr);
+    vkDestroyPipeline(context.device, this->drawPipeline, nullptr);
+    vkDestroyPipelineLayout(context.device, this->cullLayout, nullptr);
+    vkDestroyPipelineLayout(context.device, this->drawLayout, nullptr);
+    this->descriptors.destroy(context);
+    vkDestroyDescriptorSetLayout(context.device, this->setLayout.layout, nullptr);
+    this->objects.destroy(context);
+    this->commands.destroy(context);
+    this->count.destroy(context);
+}
+
+//=====================================================================
+//===============================FRAME CAPTURE=========================
+//=====================================================================
+
+static void appendBigEndian(std::vector<unsigned char> & file, uint32_t value){
+    file.push_back(static_cast<unsigned char>(value >> 24));
+    file.push_back(static_cast<unsigned char>(value >> 16));
+    file.push_back(static_cast<unsigned char>(value >> 8));
+    file.push_back(static_cast<unsigned char>(value));
+}
+
+//https://qoiformat.org/qoi-specification.pdf, the inverse of decodeQOI
+void encodeQOI(const unsigned char * rgba, uint32_t width, uint32_t height, bool withAlpha, std::vector<unsigned char> & file){
+    size_t pixelCount = (size_t) width * height;
+    file.clear();
+    file.reserve(14 + pixelCount * (withAlpha ? 5 : 4) + 8);
+    file.push_back('q');
+    file.push_back('o');
+    file.push_back('i');
+    file.push_back('f');
+    appendBigEndian(file, width);
+    appendBigEndian(file, height);
+    file.push_back(withAlpha ? 4 : 3);
+    file.push_back(0);
+
+    unsigned char index[64][4] = {};
+    unsigned char previous[4] = {0, 0, 0, 255};
+    unsigned char px[4];
+    uint32_t run = 0;
+
+    for(size_t i = 0; i < pixelCount; i++){
+        memcpy(px, &rgba[i * 4], 4);
+        if(!withAlpha){
+            px[3] = 255;
+        }
+
+        if(memcmp(px, previous, 4) == 0){
+            run++;
+            if(run == 62 || i + 1 == pixelCount){
+                file.push_back(0xc0 | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if(run > 0){
+            file.push_back(0xc0 | (run - 1));
+            run = 0;
+        }
+
+        unsigned char hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+        if(memcmp(index[hash], px, 4) == 0){
+            file.push_back(hash);
+        }else{
+            memcpy(index[hash], px, 4);
+            if(px[3] == previous[3]){
+                signed char redDiff = static_cast<signed char>(px[0] - previous[0]);
+                signed char greenDiff = static_cast<signed char>(px[1] - previous[1]);
+                signed char blueDiff = static_cast<signed char>(px[2] - previous[2]);
+                int redGreen = redDiff - greenDiff;
+                int blueGreen = blueDiff - greenDiff;
+                if(redDiff >= -2 && redDiff <= 1 && greenDiff >= -2 && greenDiff <= 1 && blueDiff >= -2 && blueDiff <= 1){
+                    file.push_back(0x40 | ((redDiff + 2) << 4) | ((greenDiff + 2) << 2) | (blueDiff + 2));
+                }else if(greenDiff >= -32 && greenDiff <= 31 && redGreen >= -8 && redGreen <= 7 && blueGreen >= -8 && blueGreen <= 7){
+                    file.push_back(0x80 | (greenDiff + 32));
+                    file.push_back(((redGreen + 8) << 4) | (blueGreen + 8));
+                }else{
+                    file.push_back(0xfe);
+                    file.push_back(px[0]);
+                    file.push_back(px[1]);
+                    file.push_back(px[2]);
+                }
+            }else{
+                file.push_back(0xff);
+                file.push_back(px[0]);
+                file.push_back(px[1]);
+                file.push_back(px[2]);
+                file.push_back(px[3]);
+            }
+        }
+        memcpy(previous, px, 4);
+    }
+
+    for(int i = 0; i < 7; i++){
+        file.push_back(0);
+    }
+    file.push_back(1);
+}
+
+static uint32_t pngCRC(const unsigned char * bytes, size_t size){
+    static const std::vector<uint32_t> table = []{
+        std::vector<uint32_t> table(256);
+        for(uint32_t i = 0; i < 256; i++){
+            uint32_t value = i;
+            for(int bit = 0; bit < 8; bit++){
+                value = (value & 1) ? 0xedb88320u ^ (value >> 1) : value >> 1;
+            }
+            table[i] = value;
+        }
+        return table;
+    }();
+
+    uint32_t crc = 0xffffffffu;
+    for(size_t i = 0; i < size; i++){
+        crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffffu;
+}
+
+static void appendPNGChunk(std::vector<unsigned char> & file, const char * type, const std::vector<unsigned char> & data){
+    appendBigEndian(file, static_cast<uint32_t>(data.size()));
+    size_t start = file.size();
+    file.insert(file.end(), type, type + 4);
+    file.insert(file.end(), data.begin(), data.end());
+    appendBigEndian(file, pngCRC(&file[start], file.size() - start));
+}
+
+//8 bit truecolor, unfiltered rows in stored deflate blocks. larger than a
+//compressed png but written at memcpy speed and readable everywhere
+void encodePNG(const unsigned char * rgba, uint32_t width, uint32_t height, bool withAlpha, std::vector<unsigned char> & file){
+    uint32_t channels = withAlpha ? 4 : 3;
+    size_t rowSize = (size_t) width * channels + 1;
+    size_t rawSize = rowSize * height;
+
+    //zlib stream: header, stored blocks of at most 65535 bytes, adler32
+    std::vector<unsigned char> idat;
+    size_t blockCount = (rawSize + 65534) / 65535;
+    idat.reserve(2 + rawSize + blockCount * 5 + 4);
+    idat.push_back(0x78);
+    idat.push_back(0x01);
+
+    uint32_t adlerLow = 1;
+    uint32_t adlerHigh = 0;
+    std::vector<unsigned char> row(rowSize);
+    size_t blockLeft = 0;
+    size_t rawLeft = rawSize;
+    for(uint32_t y = 0; y < height; y++){
+        //filter type 0, the pixels as they are
+        row[0] = 0;
+        const unsigned char * source = &rgba[(size_t) y * width * 4];
+        if(withAlpha){
+            memcpy(&row[1], source, (size_t) width * 4);
+        }else{
+            for(uint32_t x = 0; x < width; x++){
+                memcpy(&row[1 + x * 3], &source[x * 4], 3);
+            }
+        }
+
+        for(size_t i = 0; i < rowSize; i++){
+            adlerLow += row[i];
+            if(adlerLow >= 65521){
+                adlerLow -= 65521;
+            }
+            adlerHigh += adlerLow;
+            if(adlerHigh >= 65521){
+                adlerHigh -= 65521;
+            }
+        }
+
+        size_t copied = 0;
+        while(copied < rowSize){
+            if(blockLeft == 0){
+                blockLeft = std::min<size_t>(rawLeft, 65535);
+                uint16_t length = static_cast<uint16_t>(blockLeft);
+                idat.push_back(rawLeft == blockLeft ? 1 : 0);
+                idat.push_back(length & 0xff);
+                idat.push_back(length >> 8);
+                idat.push_back(~length & 0xff);
+                idat.push_back((~length >> 8) & 0xff);
+            }
+            size_t amount = std::min(blockLeft, rowSize - copied);
+            idat.insert(idat.end(), row.begin() + copied, row.begin() + copied + amount);
+            copied += amount;
+            blockLeft -= amount;
+            rawLeft -= amount;
+        }
+    }
+    appendBigEndian(idat, (adlerHigh << 16) | adlerLow);
+
+    std::vector<unsigned char> header;
+    appendBigEndian(header, width);
+    appendBigEndian(header, height);
+    header.push_back(8);
+    header.push_back(withAlpha ? 6 : 2);
+    header.push_back(0);
+    header.push_back(0);
+    header.push_back(0);
+
+    const unsigned char signature[8] = {0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a};
+    file.assign(signature, signature + 8);
+    appendPNGChunk(file, "IHDR", header);
+    appendPNGChunk(file, "IDAT", idat);
+    appendPNGChunk(file, "IEND", {});
+}
+
+static uint32_t readBigEndian(const unsigned char * bytes){
+    return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) |
+           (static_cast<uint32_t>(bytes[2]) << 8) | static_cast<uint32_t>(bytes[3]);
+}
+
+//reads back exactly what encodePNG writes: crc checked chunks, one zlib
+//stream of stored blocks and unfiltered rows. anything else is rejected
+static bool decodeStoredPNG(const std::vector<unsigned char> & file, uint32_t & width, uint32_t & height, bool & withAlpha, std::vector<unsigned char> & pixels){
+    const unsigned char signature[8] = {0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a};
+    if(file.size() < 8 || memcmp(file.data(), signature, 8) != 0){
+        return false;
+    }
+
+    std::vector<unsigned char> idat;
+    bool headerSeen = false;
+    bool endSeen = false;
+    size_t position = 8;
+    while(!endSeen && position + 12 <= file.size()){
+        uint32_t length = readBigEndian(&file[position]);
+        if(length > file.size() - position - 12){
+            return false;
+        }
+        const unsigned char * type = &file[position + 4];
+        const unsigned char * data = type + 4;
+        if(readBigEndian(data + length) != pngCRC(type, length + 4)){
+            return false;
+        }
+
+        if(memcmp(type, "IHDR", 4) == 0 && length == 13){
+            width = readBigEndian(data);
+            height = readBigEndian(data + 4);
+            if(data[8] != 8 || (data[9] != 2 && data[9] != 6) || data[10] != 0 || data[11] != 0 || data[12] != 0){
+                return false;
+            }
+            withAlpha = data[9] == 6;
+            headerSeen = true;
+        }else if(memcmp(type, "IDAT", 4) == 0){
+            idat.insert(idat.end(), data, data + length);
+        }else if(memcmp(type, "IEND", 4) == 0){
+            endSeen = true;
+        }
+        position += length + 12;
+    }
+    if(!headerSeen || !endSeen || idat.size() < 6 || idat[0] != 0x78 || ((idat[0] << 8) | idat[1]) % 31 != 0){
+        return false;
+    }
+
+    std::vector<unsigned char> raw;
+    size_t offset = 2;
+    bool last = false;
+    while(!last){
+        if(offset + 5 > idat.size() || (idat[offset] & 0x06) != 0){
+            return false;
+        }
+        last = idat[offset] & 1;
+        uint32_t length = idat[offset + 1] | (idat[offset + 2] << 8);
+        uint32_t inverse = idat[offset + 3] | (idat[offset + 4] << 8);
+        offset += 5;
+        if((length ^ 0xffff) != inverse || length > idat.size() - offset){
+            return false;
+        }
+        raw.insert(raw.end(), idat.begin() + offset, idat.begin() + offset + length);
+        offset += length;
+    }
+    if(offset + 4 != idat.size()){
+        return false;
+    }
+
+    uint32_t adlerLow = 1;
+    uint32_t adlerHigh = 0;
+    for(auto byte : raw){
+        adlerLow = (adlerLow + byte) % 65521;
+        adlerHigh = (adlerHigh + adlerLow) % 65521;
+    }
+    if(readBigEndian(&idat[offset]) != ((adlerHigh << 16) | adlerLow)){
+        return false;
+    }
+
+    uint32_t channels = withAlpha ? 4 : 3;
+    size_t rowSize = (size_t) width * channels + 1;
+    if(raw.size() != rowSize * height){
+        return false;
+    }
+    pixels.resize((size_t) width * height * 4);
+    for(uint32_t y = 0; y < height; y++){
+        const unsigned char * row = &raw[y * rowSize];
+        if(row[0] != 0){
+            return false;
+        }
+        for(uint32_t x = 0; x < width; x++){
+            unsigned char * px = &pixels[((size_t) y * width + x) * 4];
+            memcpy(px, &row[1 + x * channels], channels);
+            px[3] = withAlpha ? px[3] : 255;
+        }
+    }
+    return true;
+}
+
+bool checkCaptureEncoders(){
+    //every qoi op, runs longer than one 62 pixel op, and png rows wider
+    //than a 65535 byte stored block so rows and blocks cross
+    uint32_t width = 20000;
+    uint32_t height = 3;
+    std::vector<unsigned char> rgba((size_t) width * height * 4);
+    uint32_t seed = 0x9e3779b9u;
+    for(size_t i = 0; i < (size_t) width * height; i++){
+        unsigned char * px = &rgba[i * 4];
+        size_t x = i % width;
+        if(x < 200){
+            //a run of 150 equal pixels, then small steps for diff and luma
+            unsigned char value = x < 150 ? 40 : static_cast<unsigned char>(40 + (x - 150) * ((x & 1) ? 1 : 9));
+            px[0] = value;
+            px[1] = value;
+            px[2] = static_cast<unsigned char>(value + 3);
+            px[3] = 255;
+        }else{
+            //repeating palette for index hits, noise for full rgb and rgba
+            seed = seed * 1664525u + 1013904223u;
+            uint32_t value = (x % 7 == 0) ? static_cast<uint32_t>(x % 5) * 0x01020304u : seed;
+            memcpy(px, &value, 4);
+            px[3] = (x % 3 == 0) ? static_cast<unsigned char>(seed >> 24) : 255;
+        }
+    }
+
+    for(int alpha = 0; alpha < 2; alpha++){
+        bool withAlpha = alpha == 1;
+        std::vector<unsigned char> expected = rgba;
+        for(size_t i = 0; !withAlpha && i < expected.size(); i += 4){
+            expected[i + 3] = 255;
+        }
+
+        std::vector<unsigned char> encoded;
+        std::vector<unsigned char> decoded;
+        uint32_t decodedWidth = 0;
+        uint32_t decodedHeight = 0;
+
+        encodeQOI(rgba.data(), width, height, withAlpha, encoded);
+        std::vector<char> qoi(encoded.begin(), encoded.end());
+        if(!decodeQOI(qoi, decodedWidth, decodedHeight, decoded) || decodedWidth != width ||
+           decodedHeight != height || decoded != expected){
+            return false;
+        }
+
+        bool decodedAlpha = false;
+        encodePNG(rgba.data(), width, height, withAlpha, encoded);
+        if(!decodeStoredPNG(encoded, decodedWidth, decodedHeight, decodedAlpha, decoded) || decodedWidth != width ||
+           decodedHeight != height || decodedAlpha != withAlpha || decoded != expected){
+            return false;
+        }
+    }
+    return true;
+}
+
+void FrameCapture::init(Context & context, ThreadPool & threadPool, uint32_t slotCount, const std::string & directory, CaptureFormat format){
+    this->encoders = &threadPool;
+    this->directory = directory;
+    if(!this->directory.empty() && this->directory.back() != '/' && this->directory.back() != '\\'){
+        this->directory += '/';
+    }
+    this->format = format;
+    this->slots.resize(std::max(slotCount, 1u));
+
+    //a format bug would silently corrupt every captured frame
+    if(!checkCaptureEncoders()){
+        std::cout << "capture encoders failed their round trip check" << std::endl;
+        exit(1);
+    }
+    this->next = 0;
+
+    //the cpu reads every byte the gpu writes, cached memory keeps those
+    //reads at memory speed. non coherent memory is invalidated per slot
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(context.physicalDevice, &memProperties);
+    this->memoryProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    for(uint32_t i = 0; i < memProperties.memoryTypeCount; i++){
+        VkMemoryPropertyFlags cached = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+        if((memProperties.memoryTypes[i].propertyFlags & cached) == cached){
+            this->memoryProperties = cached;
+            break;
+        }
+    }
+}
+
+bool FrameCapture::capture(Context & context, VkCommandBuffer commandBuffer, Display & display, uint32_t imageIndex, VkImageLayout layout, uint64_t frameNumber){
+    if(!display.readable){
+        return false;
+    }
+    this->collect(context);
+
+    Slot & slot = this->slots[this->next];
+    {
+        std::lock_guard<std::mutex> lock(this->slotMutex);
+        if(slot.state != SLOT_FREE){
+            //waiting here would stall the frame on the gpu or an encoder
+            this->dropped++;
+            return false;
+        }
+    }
+
+    //the slot is idle on both sides, so it can be resized on the spot
+    VkExtent2D extent = display.swapchainExtent;
+    VkDeviceSize size = (VkDeviceSize) extent.width * extent.height * 4;
+    if(slot.capacity < size){
+        if(slot.capacity != 0){
+            slot.buffer.destroy(context);
+        }
+        slot.buffer.init(context, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_SHARING_MODE_EXCLUSIVE, this->memoryProperties);
+        slot.mapped = static_cast<const unsigned char *>(slot.buffer.getMapped(context));
+        slot.capacity = size;
+    }
+
+    //the pass's outgoing dependency orders its final layout transition
+    //before transfers, this barrier chains on from there
+    VkImage image = display.images[imageIndex].image;
+    VkImageMemoryBarrier2 toTransfer = {
+        VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,                       //sType
+        nullptr,                                                        //pNext
+        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_2_COPY_BIT, //srcStageMask
+        VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,                         //srcAccessMask
+        VK_PIPELINE_STAGE_2_COPY_BIT,                                   //dstStageMask
+        VK_ACCESS_2_TRANSFER_READ_BIT,                                  //dstAccessMask
+        layout,                                                         //oldLayout
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,                           //newLayout
+        VK_QUEUE_FAMILY_IGNORED,                                        //srcQueueFamilyIndex
+        VK_QUEUE_FAMILY_IGNORED,                                        //dstQueueFamilyIndex
+        image,                                                          //image
+        {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}                         //subresourceRange
+    };
+    VkDependencyInfo toTransferInfo = {
+        VK_STRUCTURE_TYPE_DEPENDENCY_INFO,                              //sType
+        nullptr,                                                        //pNext
+        0,                                                              //dependencyFlags
+        0,                                                              //memoryBarrierCount
+        nullptr,                                                        //pMemoryBarriers
+        0,                                                              //bufferMemoryBarrierCount
+        nullptr,                                                        //pBufferMemoryBarriers
+        1,                                                              //imageMemoryBarrierCount
+        &toTransfer                                                     //pImageMemoryBarriers
+    };
+    vkCmdPipelineBarrier2(commandBuffer, &toTransferInfo);
+
+    VkBufferImageCopy region = {
+        0,                                                              //bufferOffset
+        0,                                                              //bufferRowLength
+        0,                                                              //bufferImageHeight
+        {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},                           //imageSubresource
+        {0, 0, 0},                                                      //imageOffset
+        {extent.width, extent.height, 1}                                //imageExtent
+    };
+    vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer.getBuffer(), 1, &region);
+
+    //the image goes back to its layout before the next pass writes it
+    //again, and the copied bytes are made visible to the host
+    VkImageMemoryBarrier2 toAttachment = {
+        VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,                       //sType
+        nullptr,                                                        //pNext
+        VK_PIPELINE_STAGE_2_COPY_BIT,                                   //srcStageMask
+        0,                                                              //srcAccessMask
+        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,                //dstStageMask
+        0,                                                              //dstAccessMask
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,                           //oldLayout
+        layout,                                                         //newLayout
+        VK_QUEUE_FAMILY_IGNORED,                                        //srcQueueFamilyIndex
+        VK_QUEUE_FAMILY_IGNORED,                                        //dstQueueFamilyIndex
+        image,                                                          //image
+        {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}                         //subresourceRange
+    };
+    VkBufferMemoryBarrier2 toHost = {
+        VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,                      //sType
+        nullptr,                                                        //pNext
+        VK_PIPELINE_STAGE_2_COPY_BIT,                                   //srcStageMask
+        VK_ACCESS_2_TRANSFER_WRITE_BIT,                                 //srcAccessMask
+        VK_PIPELINE_STAGE_2_HOST_BIT,                                   //dstStageMask
+        VK_ACCESS_2_HOST_READ_BIT,                                      //dstAccessMask
+        VK_QUEUE_FAMILY_IGNORED,                                        //srcQueueFamilyIndex
+        VK_QUEUE_FAMILY_IGNORED,                                        //dstQueueFamilyIndex
+        slot.buffer.getBuffer(),                                        //buffer
+        0,                                                              //offset
+        size                                                            //size
+    };
+    VkDependencyInfo afterCopyInfo = {
+        VK_STRUCTURE_TYPE_DEPENDENCY_INFO,                              //sType
+        nullptr,                                                        //pNext
+        0,                                                              //dependencyFlags
+        0,                                                              //memoryBarrierCount
+        nullptr,                                                        //pMemoryBarriers
+        1,                                                              //bufferMemoryBarrierCount
+        &toHost,                                                        //pBufferMemoryBarriers
+        1,                                                              //imageMemoryBarrierCount
+        &toAttachment                                                   //pImageMemoryBarriers
+    };
+    vkCmdPipelineBarrier2(commandBuffer, &afterCopyInfo);
+
+    std::lock_guard<std::mutex> lock(this->slotMutex);
+    slot.extent = extent;
+    slot.frameNumber = frameNumber;
+    slot.state = SLOT_RECORDED;
+    this->next = (this->next + 1) % this->slots.size();
+    this->captured++;
+    return true;
+}
+
+void FrameCapture::submitted(const SyncToken & token){
+    std::lock_guard<std::mutex> lock(this->slotMutex);
+    for(auto & slot : this->slots){
+        if(slot.state == SLOT_RECORDED){
+            slot.token = token;
+            slot.state = SLOT_IN_FLIGHT;
+        }
+    }
+}
+
+void FrameCapture::collect(Context & context){
+    std::lock_guard<std::mutex> lock(this->slotMutex);
+    for(auto & slot : this->slots){
+        if(slot.state != SLOT_IN_FLIGHT || !context.isComplete(slot.token)){
+            continue;
+        }
+        slot.buffer.invalidate(context);
+        slot.state = SLOT_ENCODING;
+        Slot * encoding = &slot;
+        this->encoders->submit([this, encoding]{
+            this->encode(*encoding);
+        });
+    }
+}
+
+//runs on an encoder thread, reads straight out of the mapping
+void FrameCapture::encode(Slot & slot){
+    uint64_t start = steadyNanoseconds();
+    const unsigned char * pixels = slot.mapped;
+
+    //the swapchain is composited opaque, its alpha carries nothing
+    std::vector<unsigned char> file;
+    std::string extension;
+    if(this->format == CAPTURE_PNG){
+        encodePNG(pixels, slot.extent.width, slot.extent.height, false, file);
+        extension = ".png";
+    }
+    else{
+        encodeQOI(pixels, slot.extent.width, slot.extent.height, false, file);
+        extension = ".qoi";
+    }
+
+    std::string number = std::to_string(slot.frameNumber);
+    if(number.size() < 6){
+        number.insert(0, 6 - number.size(), '0');
+    }
+    std::ofstream out(this->directory + "frame_" + number + extension, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(file.data()), file.size());
+    bool success = out.good();
+    out.close();
+
+    double elapsed = (steadyNanoseconds() - start) / 1000000.0;
+    {
+        std::lock_guard<std::mutex> lock(this->slotMutex);
+        if(success){
+            this->written++;
+        }
+        else{
+            this->failed++;
+        }
+        this->encodeTotal += elapsed;
+        slot.state = SLOT_FREE;
+    }
+    this->slotEncoded.notify_all();
+}
+
+void FrameCapture::flush(Context & context){
+    std::vector<SyncToken> pending;
+    {
+        std::lock_guard<std::mutex> lock(this->slotMutex);
+        for(auto & slot : this->slots){
+            if(slot.state == SLOT_IN_FLIGHT){
+                pending.push_back(slot.token);
+            }
+        }
+    }
+    for(auto & token : pending){
+        context.wait(token);
+    }
+    this->collect(context);
+
+    std::unique_lock<std::mutex> lock(this->slotMutex);
+    this->slotEncoded.wait(lock, [this]{
+        for(auto & slot : this->slots){
+            if(slot.state == SLOT_ENCODING){
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+void FrameCapture::report(){
+    std::lock_guard<std::mutex> lock(this->slotMutex);
+    std::cout << "frame capture: " << this->captured << " frames captured, " << this->dropped << " dropped for a busy slot, "
+              << this->written << " written to " << this->directory;
+    if(this->failed > 0){
+        std::cout << ", " << this->failed << " could not be written";
+    }
+    std::cout << std::endl;
+    if(this->written + this->failed > 0){
+        std::cout << "frame capture: " << this->encodeTotal / (this->written + this->failed) << " ms average encode on "
+                  << this->encoders->getThreadCount() << " threads" << std::endl;
+    }
+}
+
+void FrameCapture::destroy(Context & context){
+    this->flush(context);
+    for(auto & slot : this->slots){
+        if(slot.capacity != 0){
+            slot.buffer.destroy(context);
+        }
+    }
+    this->slots.clear();
+}
@@ -13,6 +13,14 @@
 #include "string"
 #include "vector"
 #include "Array"
+#include "thread"
+#include "mutex"
+#include "condition_variable"
+#include "functional"
+#include "queue"
+#include "unordered_map"
+#include "unordered_set"
+#include "deque"
 
 class Vertex{
     private:
@@ -25,17 +33,64 @@ class Vertex{
         static std::vector<VkVertexInputAttributeDescription> * getAttributeDescriptions();
 };
 
+//per-instance stream read at VK_VERTEX_INPUT_RATE_INSTANCE from binding 1,
+//after the Vertex attributes. the transform takes locations 2 to 5
+struct InstanceData{
+    glm::mat4 transform;
+    glm::vec4 color;
+    glm::vec4 custom;
+
+    static VkVertexInputBindingDescription getBindingDescription();
+    static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions();
+};
+
+static const uint32_t INSTANCE_BINDING = 1;
+
+//every device supports at least this much push constant space, anything
+//pushed through the typed helpers is checked against it at compile time
+static const uint32_t GUARANTEED_PUSH_CONSTANT_SIZE = 128;
+
+//per-draw data small enough to travel in push constants
+struct DrawData{
+    glm::mat4 model;
+    uint32_t materialIndex;
+    uint32_t padding[3];
+};
+
 struct DeviceQueue{
     VkQueue queueFamily;
     uint32_t queueFamilyIndex;
     uint32_t queueCount;
 };
 
+//a point on one queue's timeline semaphore. every submit signals the next
+//value, so the token is done once the counter reaches it. value 0 is the
+//empty token and always complete
+struct SyncToken{
+    uint32_t queue;
+    uint64_t value;
+};
+
+static const uint32_t GRAPHICS_TIMELINE = 0;
+static const uint32_t COMPUTE_TIMELINE = 1;
+
+class QueueTimeline{
+    public:
+        VkQueue queue;
+        VkSemaphore semaphore;
+        uint64_t submitted;     //highest value handed to a submit
+        uint64_t completed;     //last value seen finished, saves a driver call
+};
+
 class Context{
     private:
+        std::vector<VkExtensionProperties> availableDeviceExtensions;
+        std::vector<QueueTimeline> timelines;
+
         void createInstance();
         void createPhysicalDevice();
         void createLogicalDeviceAndQueue();
+        void createTimelines();
 
     public:
         VkInstance instance;
@@ -43,8 +98,40 @@ class Context{
         VkPhysicalDevice physicalDevice;
         VkDevice device;
         DeviceQueue queue;
+        DeviceQueue computeQueue;
+
+        //set before initContext to put compute on the graphics queue, for
+        //comparing against async compute
+        bool forceSingleQueue = false;
+        //set before initContext to skip sdl entirely, for ci and render
+        //farm machines without a display
+        bool headless = false;
+        bool headlessSurfaceSupported = false;
+        bool swapchainSupported;
+        //compute has a queue of its own and can overlap graphics
+        bool asyncComputeSupported;
+
+        VkPhysicalDeviceProperties properties;
+
+        //features actually enabled on the device, check before relying on one
+        VkPhysicalDeviceFeatures features;
+        VkPhysicalDeviceVulkan12Features features12;
+        VkPhysicalDeviceVulkan13Features features13;
+        VkPhysicalDeviceHostImageCopyFeaturesEXT hostImageCopyFeatures;
+        bool bindlessSupported;
+        bool hostImageCopySupported;
 
         void initContext();
+        uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+        bool hasDeviceExtension(const char * name);
+
+        //tokens are handed out and queried on the submitting thread
+        SyncToken nextToken(uint32_t queue);
+        SyncToken lastSubmitted(uint32_t queue);
+        VkSemaphore getTimeline(uint32_t queue);
+        VkQueue getQueue(uint32_t queue);
+        bool isComplete(const SyncToken &);
+        void wait(const SyncToken &);
 };
 
 class Image{
@@ -69,6 +156,94 @@ class CommandBuffer{
         void initCommandBuffer(Context &, VkCommandPool &);
 };
 
+//hands out command buffers from one transient pool and recycles them all
+//with a single vkResetCommandPool once the gpu is done with them. buffers
+//are kept across resets so steady state allocates nothing. not thread safe,
+//give each recording thread its own
+class CommandAllocator{
+    private:
+        VkCommandPool pool;
+        std::vector<VkCommandBuffer> primaries;
+        std::vector<VkCommandBuffer> secondaries;
+        uint32_t nextPrimary = 0;
+        uint32_t nextSecondary = 0;
+    public:
+        CommandAllocator() = default;
+        void init(Context &);
+        void init(Context &, uint32_t queueFamilyIndex);
+        VkCommandBuffer allocate(Context &, VkCommandBufferLevel);
+        void reset(Context &);
+        VkCommandPool getPool(){return pool;}
+        void destroy(Context &);
+};
+
+//wraps a command buffer and remembers what is bound on it. binds, pushes and
+//dynamic state that would not change anything are dropped before they reach
+//the driver. counters cover everything since begin, so they read per frame
+//when begin runs once a frame. state is unknown again after executing
+//secondaries, call invalidate then
+class CommandRecorder{
+    private:
+        static const uint32_t MAX_SHADOWED_SETS = 8;
+        static const uint32_t MAX_SHADOWED_BINDINGS = 4;
+        static const uint32_t SHADOWED_PUSH_BYTES = 256;
+
+        struct BindPointState{
+            VkPipeline pipeline;
+            VkPipelineLayout setLayouts[MAX_SHADOWED_SETS];
+            VkDescriptorSet sets[MAX_SHADOWED_SETS];
+        };
+        struct VertexBinding{
+            VkBuffer buffer;
+            VkDeviceSize offset;
+        };
+
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        //graphics and compute
+        BindPointState bindPoints[2];
+        VertexBinding vertexBindings[MAX_SHADOWED_BINDINGS];
+        VkBuffer indexBuffer;
+        VkDeviceSize indexOffset;
+        VkIndexType indexType;
+
+        VkPipelineLayout pushLayout;
+        VkShaderStageFlags pushStages;
+        uint32_t pushBegin;
+        uint32_t pushEnd;
+        unsigned char pushData[SHADOWED_PUSH_BYTES];
+
+        bool viewportSet;
+        VkViewport viewport;
+        bool scissorSet;
+        VkRect2D scissor;
+
+        uint32_t issued = 0;
+        uint32_t dropped = 0;
+
+        bool keep(bool changed);
+    public:
+        CommandRecorder() = default;
+        void begin(VkCommandBuffer);
+        void invalidate();
+        VkCommandBuffer get(){return commandBuffer;}
+
+        void bindPipeline(VkPipelineBindPoint, VkPipeline);
+        void bindVertexBuffer(uint32_t binding, VkBuffer, VkDeviceSize offset = 0);
+        void bindIndexBuffer(VkBuffer, VkDeviceSize offset, VkIndexType);
+        void bindDescriptorSet(VkPipelineBindPoint, VkPipelineLayout, uint32_t setIndex, VkDescriptorSet);
+        void pushConstants(VkPipelineLayout, VkShaderStageFlags, uint32_t offset, uint32_t size, const void * data);
+        template<typename T> void pushConstants(VkPipelineLayout, VkShaderStageFlags, const T &);
+        void setViewport(const VkViewport &);
+        void setScissor(const VkRect2D &);
+
+        void draw(uint32_t vertexCount, uint32_t instanceCount = 1, uint32_t firstVertex = 0, uint32_t firstInstance = 0);
+        void drawIndexed(uint32_t indexCount, uint32_t instanceCount = 1, uint32_t firstIndex = 0, int32_t vertexOffset = 0, uint32_t firstInstance = 0);
+
+        uint32_t getIssued(){return issued;}
+        uint32_t getDropped(){return dropped;}
+        void report();
+};
+
 class Fence{
     public:
         VkFence fence;
@@ -83,10 +258,69 @@ class Semaphore{
         void initSemaphore(Context &);
 };
 
+//collects waits, command buffers and signals from every subsystem during a
+//frame and hands them to the queue in one vkQueueSubmit2. a wait added after
+//command buffers, or anything added after a signal, opens a new submit info
+//in the same call so ordering is kept. the last one signals the timeline
+class SubmitBatcher{
+    private:
+        struct Batch{
+            uint32_t firstWait;
+            uint32_t waitCount;
+            uint32_t firstBuffer;
+            uint32_t bufferCount;
+            uint32_t firstSignal;
+            uint32_t signalCount;
+        };
+        std::vector<VkSemaphoreSubmitInfo> waits;
+        std::vector<VkCommandBufferSubmitInfo> buffers;
+        std::vector<VkSemaphoreSubmitInfo> signals;
+        std::vector<Batch> batches;
+        std::vector<VkSubmitInfo2> submits;
+        std::vector<std::function<void(const SyncToken &)>> submitted;
+
+        Batch & openBatch(bool forWait);
+    public:
+        SubmitBatcher() = default;
+        void wait(VkSemaphore, VkPipelineStageFlags2, uint64_t value = 0);
+        void wait(Context &, const SyncToken &, VkPipelineStageFlags2);
+        void add(VkCommandBuffer);
+        void signal(VkSemaphore, VkPipelineStageFlags2, uint64_t value = 0);
+        //called with the flush's token once the batch is on the queue, for
+        //work added now that needs to know when it retires. timeline values
+        //are only taken at submit, so they always go out in order
+        void onSubmit(std::function<void(const SyncToken &)>);
+        SyncToken flush(Context &, uint32_t queue = GRAPHICS_TIMELINE);
+        uint32_t getBatchCount(){return static_cast<uint32_t>(batches.size());}
+};
+
+//how the swapchain trades latency against smoothness and power.
+//lowest latency presents immediately or through mailbox on two images,
+//smooth queues vsynced frames on three, power saver lets late frames tear
+//through fifo relaxed instead of waiting a whole extra refresh
+enum PresentPolicy{
+    PRESENT_LOWEST_LATENCY,
+    PRESENT_SMOOTH,
+    PRESENT_POWER_SAVER
+};
+
 class Display{
     private:
+        //acquire to present on the cpu, in milliseconds
+        uint64_t acquireTime = 0;
+        uint64_t presentCount = 0;
+        double latencyTotal = 0.0;
+        double latencyMax = 0.0;
+
+        //offscreen targets when there is no swapchain
+        std::vector<VkDeviceMemory> offscreenMemory;
+        uint32_t nextOffscreen = 0;
+        //used when neither the surface nor a window decides the extent
+        VkExtent2D requestedExtent;
+
         void createWindowAndSurface(Context &, int, int);
-        void createSwapchain(Context &); 
+        void choosePresentConfig(Context &, const VkSurfaceCapabilitiesKHR &);
+        void createOffscreenImages(Context &, uint32_t count);
 
     public:
         SDL_Window* window;
@@ -95,17 +329,54 @@ class Display{
         VkViewport viewport;
         VkRect2D defaultScissor;
 
-        VkSwapchainKHR swapchain;
+        VkSwapchainKHR swapchain = VK_NULL_HANDLE;
         VkExtent2D swapchainExtent;
+        //views of the current swapchain, refreshed by getImagesAndViews
+        std::vector<Image> images;
+        //set when acquire or present reports the swapchain no longer
+        //matches the surface, the frame ring recreates it before the next
+        //acquire
+        bool outOfDate = false;
+
+        //set before initDisplay, or through setPresentPolicy afterwards
+        PresentPolicy presentPolicy = PRESENT_SMOOTH;
+        //what the surface actually granted for the policy
+        VkPresentModeKHR presentMode;
+        uint32_t imageCount;
+
+        //rendering into plain images, nothing is acquired or presented
+        bool offscreen = false;
+        //images can be copied out, the surface may not allow it
+        bool readable = false;
 
         void initDisplay(Context &, int, int);
+        //no window. swapchain on a headless surface when the instance has
+        //one and useSurface is set, offscreen images otherwise
+        void initHeadless(Context &, int width, int height, bool useSurface = true, uint32_t offscreenImages = 2);
+        uint32_t getImageCount(Context &);
+        void destroy(Context &);
+        //takes effect when the swapchain is next recreated, which this
+        //requests
+        void setPresentPolicy(PresentPolicy);
+        void recordPresent();
+        void report();
+        //passes the current swapchain as oldSwapchain and leaves destroying
+        //it to the caller. false while the window has no area, the old
+        //swapchain stays current then
+        bool createSwapchain(Context &);
         std::vector<Image> getImagesAndViews(Context &);
-        uint32_t getNextPresentableSwapchainIndex(Context &, Display &, Semaphore &);
+        VkResult acquireNextImage(Context &, Semaphore &, uint32_t & imageIndex);
 };
 
 class RenderPass{
     public:
         CommandBuffer commandBuffer;
+        //every state change made through the render pass goes through here
+        CommandRecorder recorder;
+        //set before initRenderPass, offscreen targets end as transfer sources
+        VkImageLayout finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        //set before initRenderPass when frames are copied out after the pass
+        bool readback = false;
         VkRenderPass renderPass;
         std::vector<VkFramebuffer> frameBuffers;
         VkRect2D renderArea;
@@ -113,13 +384,31 @@ class RenderPass{
 
         void initRenderPass(Context &, CommandBuffer &);
         void createFramebuffers(Context &, std::vector<Image>, VkExtent2D &);
+        //bumped whenever the framebuffers are rebuilt, anything recorded
+        //against the old ones has to be recorded again
+        uint32_t framebufferGeneration = 0;
         void setRenderArea(int, int);
         void setClearColor(float[4]);
+        bool recording = false;
+
+        //opens the frame's command buffer early so work that must sit
+        //outside the render pass, like compute culling, can go first
+        void beginRecording();
         void startRenderPass(VkPipeline &, int);
+        void startRenderPass(int, VkSubpassContents);
+        void executeCommands(const std::vector<VkCommandBuffer> &);
         void drawVertices(VkPipeline, int);
         void drawIndexed(int);
-        void endRenderPass();
-        void submitWork(Context &, Semaphore &, Semaphore &, Fence &);
+        void bindInstances(VkBuffer, VkDeviceSize offset);
+        void drawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex = 0, int32_t vertexOffset = 0, uint32_t firstInstance = 0);
+        void bindDescriptorSet(VkPipelineLayout, uint32_t, VkDescriptorSet);
+        template<typename T> void pushDrawData(VkPipelineLayout, VkShaderStageFlags, const T &);
+        //keepRecording leaves the command buffer open for work after the
+        //pass, like readback copies, finishRecording then closes it
+        void endRenderPass(bool keepRecording = false);
+        void finishRecording();
+        SyncToken submitWork(Context &, Semaphore &, Semaphore &);
+        void submitWork(SubmitBatcher &, Semaphore &, Semaphore &);
         void submitPresentation(Context &, Display &, Semaphore &, uint32_t);
 };
 
@@ -136,33 +425,74 @@ class PipelineBuilder{
         VkPipelineRasterizationStateCreateInfo rasterizationState;
         VkPipelineMultisampleStateCreateInfo multisampleState;
         VkPipelineColorBlendStateCreateInfo colorblendState;
+        std::vector<VkDescriptorSetLayout> descriptorSetLayouts;
+        std::vector<VkPushConstantRange> pushConstantRanges;
+        std::vector<VkVertexInputBindingDescription> vertexBindings;
+        std::vector<VkVertexInputAttributeDescription> vertexAttributes;
 
     public:
         PipelineBuilder() = default;
         void setShader(Context &, VkShaderStageFlagBits, std::string, std::string); 
         void setInputAssembly(VkPrimitiveTopology);
         void setVertexInputState();
+        //Vertex on binding 0 plus InstanceData on INSTANCE_BINDING
+        void setInstancedVertexInputState();
         void setTessellationState();
         void setViewportState(VkViewport &, VkRect2D &);
         void setRasterizationState(VkPolygonMode, VkCullModeFlagBits, VkFrontFace, float);
         void setMultisampleState();
         void setColorblendState();
+        void addDescriptorSetLayout(VkDescriptorSetLayout);
+        template<typename T> void setPushConstants(VkShaderStageFlags);
         void setPipelineLayout(Context &);
+        void setPipelineLayout(VkPipelineLayout);
+        VkPipelineLayout getPipelineLayout(){return pipelineLayout;}
         VkPipeline & createPipeline(Context &, RenderPass &);
+        VkPipeline & createPipeline(Context &, RenderPass &, VkPipelineCache);
+        VkPipeline & createComputePipeline(Context &);
+        void releaseShaderModules(Context &);
 };
 
+template<typename T> void PipelineBuilder::setPushConstants(VkShaderStageFlags stages){
+    static_assert(sizeof(T) <= GUARANTEED_PUSH_CONSTANT_SIZE, "push constant struct exceeds the guaranteed device limit");
+    static_assert(sizeof(T) % 4 == 0, "push constant size must be a multiple of 4");
+
+    VkPushConstantRange pushConstantRange = {
+        stages,                                                 //stageFlags
+        0,                                                      //offset
+        static_cast<uint32_t>(sizeof(T))                        //size
+    };
+    this->pushConstantRanges.push_back(pushConstantRange);
+}
+
+template<typename T> void RenderPass::pushDrawData(VkPipelineLayout layout, VkShaderStageFlags stages, const T & data){
+    this->recorder.pushConstants(layout, stages, data);
+}
+
+template<typename T> void CommandRecorder::pushConstants(VkPipelineLayout layout, VkShaderStageFlags stages, const T & data){
+    static_assert(sizeof(T) <= GUARANTEED_PUSH_CONSTANT_SIZE, "push constant struct exceeds the guaranteed device limit");
+    this->pushConstants(layout, stages, 0, static_cast<uint32_t>(sizeof(T)), &data);
+}
+
 class Buffer{
     private:
-        void * mappedMemory;
+        void * mappedMemory = nullptr;
         VkDeviceSize bufferSize;
         VkBuffer buffer;
         VkDeviceMemory bufferMemory;
-        uint32_t findMemoryType(Context & context, uint32_t typeFilter, VkMemoryPropertyFlags properties);
     public:
         Buffer() = default;
         void init(Context &, VkDeviceSize size, VkBufferUsageFlagBits bufType, VkSharingMode sharingMode);
+        void init(Context &, VkDeviceSize size, VkBufferUsageFlags usage, VkSharingMode sharingMode, VkMemoryPropertyFlags memoryProperties);
         void map(Context &, void * data);
+        //host visible buffers stay mapped after the first write
+        void write(Context &, const void * data, VkDeviceSize offset, VkDeviceSize size);
+        void * getMapped(Context &);
+        //makes gpu writes visible to mapped reads on non coherent memory
+        void invalidate(Context &);
+        void destroy(Context &);
         VkBuffer getBuffer(){return buffer;}
+        VkDeviceSize getSize(){return bufferSize;}
 };
 
 class VertexBuffer{
@@ -172,6 +502,8 @@ class VertexBuffer{
         VertexBuffer() = default;
         void init(Context &, std::vector<Vertex> vertices);
         void bind(CommandBuffer &);
+        void bind(CommandRecorder &);
+        VkBuffer getBuffer(){return buffer.getBuffer();}
 };
 
 class IndexBuffer{
@@ -181,8 +513,885 @@ class IndexBuffer{
         IndexBuffer() = default;
         void init(Context &, std::vector<uint16_t> indices);
         void bind(CommandBuffer &);
+        void bind(CommandRecorder &);
+        VkBuffer getBuffer(){return buffer.getBuffer();}
         
 };
 
+//where an allocation landed, data points at its mapped bytes
+struct DynamicAllocation{
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    void * data;
+};
+
+//per-frame linear allocator over one persistently mapped buffer. every frame
+//in flight owns a region and allocations bump through it, so filling
+//instance or uniform data costs a memcpy and no buffer creation. a region is
+//reused once the FrameRing has waited on the frame that last used it
+class DynamicRing{
+    private:
+        Buffer buffer;
+        VkDeviceSize regionSize;
+        uint32_t regionCount;
+        uint32_t region = 0;
+        VkDeviceSize head = 0;
+        char * mapped;
+    public:
+        DynamicRing() = default;
+        void init(Context &, VkDeviceSize regionSize, VkBufferUsageFlags usage, uint32_t framesInFlight = 2);
+        //call after FrameRing::beginFrame with its current index
+        void beginFrame(uint32_t frameIndex);
+        DynamicAllocation allocate(VkDeviceSize size, VkDeviceSize alignment = 16);
+        VkDeviceSize getUsed(){return head;}
+        void destroy(Context &);
+};
+
+class ThreadPool{
+    private:
+        std::vector<std::thread> workers;
+        std::queue<std::function<void()>> jobs;
+        std::mutex jobMutex;
+        std::condition_variable jobAvailable;
+        std::condition_variable jobsFinished;
+        uint32_t activeJobs = 0;
+        bool stopping = false;
+
+        void workerLoop();
+    public:
+        ThreadPool() = default;
+        ~ThreadPool();
+        void init(uint32_t threadCount);
+        void submit(std::function<void()> job);
+        void waitIdle();
+        uint32_t getThreadCount(){return static_cast<uint32_t>(workers.size());}
+};
+
+//everything needed to rebuild a pipeline permutation from scratch
+struct PipelineKey{
+    std::string vertexShader;
+    std::string fragmentShader;
+    VkPrimitiveTopology topology;
+    VkPolygonMode polygonMode;
+    VkCullModeFlagBits cullMode;
+    VkFrontFace frontFace;
+    float lineWidth;
+
+    uint64_t hash() const;
+    bool operator==(const PipelineKey &) const;
+};
+
+struct PipelineKeyHasher{
+    size_t operator()(const PipelineKey & key) const {return static_cast<size_t>(key.hash());}
+};
+
+class PipelineLibrary{
+    private:
+        RenderPass * renderPass;
+        Display * display;
+        VkPipelineCache pipelineCache;
+        VkPipelineLayout pipelineLayout;
+        std::string manifestPath;
+
+        std::mutex pipelineMutex;
+        //signalled whenever a compile publishes its pipeline
+        std::condition_variable pipelineReady;
+        std::unordered_map<PipelineKey, VkPipeline, PipelineKeyHasher> pipelines;
+        std::vector<PipelineKey> usedKeys;
+        std::unordered_set<PipelineKey, PipelineKeyHasher> usedKeySet;
+
+        bool warmedUp = false;
+        uint32_t warmupCount = 0;
+        double warmupMilliseconds = 0.0;
+        uint32_t misses = 0;
+
+        //async mode: missing keys compile on the pool while draws fall back
+        ThreadPool * asyncPool = nullptr;
+        //keys some thread is compiling right now, reserved under the lock so
+        //every key is built exactly once
+        std::unordered_set<PipelineKey, PipelineKeyHasher> pendingKeys;
+        VkPipeline fallbackPipeline = VK_NULL_HANDLE;
+        //getPipeline calls answered with the fallback or with nothing, a
+        //pipeline looked up once and drawn many times counts once
+        uint32_t fallbackLookups = 0;
+        uint32_t skippedLookups = 0;
+        uint32_t lastFrameFallbackLookups = 0;
+        uint32_t lastFrameSkippedLookups = 0;
+
+        VkPipeline buildPipeline(Context &, const PipelineKey &);
+        void publish(const PipelineKey &, VkPipeline);
+        //builds on the calling thread unless another one already is
+        VkPipeline buildOnce(Context &, const PipelineKey &);
+        std::vector<PipelineKey> loadManifest();
+    public:
+        PipelineLibrary() = default;
+        void init(Context &, RenderPass &, Display &, std::string manifestPath);
+        void warmup(Context &, ThreadPool &);
+        //jobs queued from getPipeline hold on to its Context, which has to
+        //outlive them. destroy() waits for the last one
+        void enableAsyncCompilation(ThreadPool &);
+        void setFallbackPipeline(Context &, const PipelineKey &);
+        VkPipeline getPipeline(Context &, const PipelineKey &);
+        void beginFrame();
+        uint32_t getFallbackLookups(){return lastFrameFallbackLookups;}
+        uint32_t getSkippedLookups(){return lastFrameSkippedLookups;}
+        void saveManifest(Context &);
+        void report();
+        //waits for compiles still running, then releases every pipeline
+        void destroy(Context &);
+        VkPipelineLayout getPipelineLayout(){return pipelineLayout;}
+};
+
+class DescriptorLayout{
+    private:
+        std::vector<VkDescriptorSetLayoutBinding> bindings;
+    public:
+        VkDescriptorSetLayout layout;
+
+        DescriptorLayout() = default;
+        void addBinding(uint32_t binding, VkDescriptorType type, VkShaderStageFlags stages, uint32_t count = 1);
+        //exits on types the DescriptorAllocator does not pool
+        void init(Context &);
+};
+
+//hands out sets from pools that grow a size class every time one runs dry.
+//reset() recycles every pool at once, so a per-frame allocator costs one
+//vkResetDescriptorPool per pool instead of one free per set
+class DescriptorAllocator{
+    private:
+        std::vector<VkDescriptorPool> usedPools;
+        std::vector<VkDescriptorPool> freePools;
+        VkDescriptorPool currentPool = VK_NULL_HANDLE;
+        uint32_t sizeClass = 0;
+
+        VkDescriptorPool createPool(Context &);
+        void nextPool(Context &);
+    public:
+        DescriptorAllocator() = default;
+        VkDescriptorSet allocate(Context &, VkDescriptorSetLayout);
+        void reset(Context &);
+        void destroy(Context &);
+};
+
+struct DescriptorWrite{
+    uint32_t binding;
+    VkDescriptorType type;
+    VkDescriptorBufferInfo bufferInfo;
+    VkDescriptorImageInfo imageInfo;
+};
+
+//sets whose contents never change are built once and looked up by hash
+class DescriptorCache{
+    private:
+        struct CachedSet{
+            VkDescriptorSetLayout layout;
+            std::vector<DescriptorWrite> writes;
+            VkDescriptorSet set;
+        };
+        DescriptorAllocator allocator;
+        std::unordered_multimap<uint64_t, CachedSet> sets;
+    public:
+        DescriptorCache() = default;
+        VkDescriptorSet getSet(Context &, VkDescriptorSetLayout, const std::vector<DescriptorWrite> &);
+        void destroy(Context &);
+};
+
+//one global set of update-after-bind arrays, bound once per frame.
+//resources get stable indices that shaders read from push constants or
+//instance data instead of binding a set per draw
+class BindlessTable{
+    private:
+        VkDescriptorPool pool;
+        std::mutex updateMutex;
+
+        uint32_t maxBuffers;
+        uint32_t maxImages;
+        uint32_t nextBuffer = 0;
+        uint32_t nextImage = 0;
+        std::vector<uint32_t> freeBuffers;
+        std::vector<uint32_t> freeImages;
+
+        //removed handles wait here until the last submit reading them retires
+        struct RetiredHandle{
+            SyncToken token;
+            uint32_t handle;
+        };
+        std::vector<RetiredHandle> retiredBuffers;
+        std::vector<RetiredHandle> retiredImages;
+
+        uint32_t allocateHandle(Context &, std::vector<RetiredHandle> &, std::vector<uint32_t> &, uint32_t &, uint32_t);
+    public:
+        static const uint32_t BUFFER_BINDING = 0;
+        static const uint32_t IMAGE_BINDING = 1;
+
+        VkDescriptorSetLayout layout;
+        VkDescriptorSet set;
+
+        BindlessTable() = default;
+        //sizes are clamped to the device's update-after-bind limits
+        void init(Context &, uint32_t maxBuffers, uint32_t maxImages);
+        uint32_t getMaxBuffers(){return maxBuffers;}
+        uint32_t getMaxImages(){return maxImages;}
+        uint32_t addBuffer(Context &, VkBuffer, VkDeviceSize offset, VkDeviceSize range);
+        uint32_t addImage(Context &, VkImageView, VkSampler, VkImageLayout);
+        //lastUse is the token of the last submit that may read the handle,
+        //it is handed out again only once that has completed
+        void removeBuffer(uint32_t, const SyncToken & lastUse);
+        void removeImage(uint32_t, const SyncToken & lastUse);
+        void bind(CommandBuffer &, VkPipelineBindPoint, VkPipelineLayout, uint32_t setIndex);
+        void destroy(Context &);
+};
+
+class SamplerCache{
+    private:
+        std::mutex samplerMutex;
+        std::unordered_map<uint64_t, VkSampler> samplers;
+    public:
+        SamplerCache() = default;
+        VkSampler getSampler(Context &, VkFilter filter, VkSamplerAddressMode addressMode);
+        void destroy(Context &);
+};
+
+//read only view of a whole file, released on destruction
+class MappedFile{
+    private:
+        void * fileHandle = nullptr;
+        void * mappingHandle = nullptr;
+    public:
+        const unsigned char * data = nullptr;
+        size_t size = 0;
+
+        MappedFile() = default;
+        ~MappedFile();
+        bool open(const std::string & path);
+        void close();
+};
+
+class Texture{
+    public:
+        Image image;
+        VkDeviceMemory memory;
+        VkSampler sampler;
+        VkImageLayout layout;
+        VkFormat format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t mipLevels;
+        //set once the upload that fills it has retired on the gpu
+        bool ready = false;
+};
+
+//pixels holds mipLevels tightly packed levels starting at levelOffsets.
+//a single uncompressed level gets the rest of its chain built on the gpu
+struct DecodedImage{
+    Texture * texture;
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    std::vector<VkDeviceSize> levelOffsets;
+    std::vector<unsigned char> pixels;
+};
+
+//files decode on the thread pool, update() then uploads every decoded
+//image through staging buffers and builds its mip chain in one submission
+class TextureLoader{
+    private:
+        ThreadPool * decodePool;
+        SamplerCache * samplerCache;
+        CommandBuffer commandBuffer;
+        SyncToken uploadToken = {};
+
+        std::mutex decodedMutex;
+        std::vector<DecodedImage> decoded;
+        //decode jobs still queued or running on the pool, destroy waits
+        //for them since they write into the loader
+        uint32_t pendingDecodes = 0;
+        std::condition_variable decodesFinished;
+        std::deque<Texture> textures;
+
+        bool uploadInFlight = false;
+        std::vector<Buffer> stagingInFlight;
+        std::vector<Texture *> texturesInFlight;
+
+        //block formats the device samples natively, decided once at init
+        bool bcSupported;
+        bool astcSupported;
+
+        //host image copy writes straight from the file mapping on the decode
+        //thread, textures finished that way are published on the next update
+        Context * context;
+        bool hostCopyEnabled = false;
+        VkImageLayout hostCopyLayout;
+        std::vector<Texture *> hostCopied;
+
+        bool decodeFile(const std::string & path, DecodedImage &);
+        bool useHostCopy(VkFormat format);
+        bool hostUpload(const std::string & path, Texture *);
+        void recordUpload(Context &, DecodedImage &, Buffer &);
+    public:
+        TextureLoader() = default;
+        void init(Context &, ThreadPool &, SamplerCache &);
+        Texture * load(std::string path);
+        void update(Context &);
+        //the batcher reports the upload's token back when it flushes, so it
+        //must flush or be dropped before the loader is destroyed
+        void update(Context &, SubmitBatcher &);
+        void destroy(Context &);
+};
+
+bool decodeQOI(const std::vector<char> & file, uint32_t & width, uint32_t & height, std::vector<unsigned char> & pixels);
+bool decodeKTX2(const std::vector<char> & file, DecodedImage & image);
+bool decodeKTX2(const unsigned char * bytes, size_t size, DecodedImage & image, bool copyLevels);
+bool blockFormatInfo(VkFormat format, uint32_t & blockWidth, uint32_t & blockHeight, uint32_t & blockBytes);
+//bc1, or bc3 with alpha. nothing else is encoded at load time
+void transcodeToBC(DecodedImage & image, bool withAlpha);
+
+//everything one frame in flight owns, reused once its token has retired
+class FrameContext{
+    public:
+        CommandAllocator commands;
+        CommandBuffer commandBuffer;
+        Semaphore imageAvailable;
+        SyncToken submitted;
+        DescriptorAllocator descriptors;
+        uint32_t imageIndex;
+        //false while the window is minimized, the frame is recorded but
+        //endFrame neither submits nor presents it
+        bool acquired;
+};
+
+//destroys resources once the gpu work that last used them has finished,
+//instead of idling the device to free them
+class DeletionQueue{
+    private:
+        struct Entry{
+            SyncToken token;
+            std::function<void(Context &)> destroy;
+        };
+        std::deque<Entry> entries;
+    public:
+        DeletionQueue() = default;
+        void push(const SyncToken &, std::function<void(Context &)>);
+        //runs every entry whose token has completed
+        void collect(Context &);
+        //waits for and runs everything, for shutdown
+        void flush(Context &);
+        size_t size(){return entries.size();}
+};
+
+//ring of frame contexts so the cpu records frame N+1 while the gpu is
+//still executing frame N. beginFrame blocks only on the frame that last
+//used the same slot, depth frames ago
+class FrameRing{
+    private:
+        std::vector<FrameContext> frames;
+        std::vector<Semaphore> renderFinished;
+        SubmitBatcher batcher;
+        DeletionQueue retired;
+        //destroyed once the submitted frame numbered frameNumber has
+        //completed, for what only the presentation engine still holds
+        struct FrameRetirement{
+            uint64_t frameNumber;
+            std::function<void(Context &)> destroy;
+        };
+        std::vector<FrameRetirement> awaitingFrame;
+        uint32_t current = 0;
+        uint64_t frameNumber = 0;
+        //frames that actually went to the queue, what retirements count in
+        uint64_t submittedFrames = 0;
+        uint32_t swapchainRecreations = 0;
 
+        void createRenderFinished(Context &, Display &);
+        bool recreateSwapchain(Context &, Display &, RenderPass &);
+    public:
+        FrameRing() = default;
+        void init(Context &, Display &, uint32_t depth = 2);
+        FrameContext & beginFrame(Context &, Display &, RenderPass &);
+        void endFrame(Context &, Display &, RenderPass &);
+        FrameContext & getCurrent(){return frames[current];}
+        uint32_t getCurrentIndex(){return current;}
+        uint32_t getDepth(){return static_cast<uint32_t>(frames.size());}
+        uint64_t getFrameNumber(){return frameNumber;}
+        //anything added here goes out with the frame's own submit
+        SubmitBatcher & getBatcher(){return batcher;}
+        void waitForPending(Context &);
+        //destroyed once every frame submitted so far has retired
+        void retire(Context &, std::function<void(Context &)>);
+        uint32_t getSwapchainRecreations(){return swapchainRecreations;}
+        void destroy(Context &);
+};
+
+//one indexed draw, everything a worker needs to record it on its own
+struct DrawCommand{
+    VkPipeline pipeline;
+    VkPipelineLayout layout;
+    VkBuffer vertexBuffer;
+    VkBuffer indexBuffer;
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    DrawData drawData;
+};
 
+//splits a draw list into slices recorded as secondary command buffers on
+//the thread pool. each slice has its own pool per frame in flight so no
+//two threads ever touch the same pool, and a pool is only reset after the
+//frame that used it has retired
+class ParallelRecorder{
+    private:
+        ThreadPool * threadPool;
+        uint32_t sliceCount;
+        std::vector<std::vector<CommandAllocator>> allocators;
+        std::vector<VkCommandBuffer> recorded;
+    public:
+        ParallelRecorder() = default;
+        void init(Context &, ThreadPool &, uint32_t framesInFlight, uint32_t sliceCount = 0);
+        const std::vector<VkCommandBuffer> & record(Context &, RenderPass &, uint32_t frameIndex, uint32_t imageIndex, const std::vector<DrawCommand> &);
+        void destroy(Context &);
+};
+
+//draws recorded once into secondaries, one per swapchain image, and
+//executed every frame until setDraws, markDirty or new framebuffers
+//invalidate them. the previous recording is retired through the frame ring
+//rather than waited on
+class StaticBundle{
+    private:
+        VkCommandPool pool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> buffers;
+        std::vector<DrawCommand> draws;
+        bool dirty = true;
+        uint32_t recordCount = 0;
+        uint32_t framebufferGeneration = 0;
+
+        void createBuffers(Context &, RenderPass &);
+    public:
+        StaticBundle() = default;
+        void init(Context &, RenderPass &);
+        void setDraws(const std::vector<DrawCommand> &);
+        void markDirty(){dirty = true;}
+        bool isDirty(){return dirty;}
+        uint32_t getRecordCount(){return recordCount;}
+        VkCommandBuffer get(Context &, FrameRing &, RenderPass &, uint32_t imageIndex);
+        void destroy(Context &);
+};
+
+//draw sort key fields from most to least significant. sorting by key groups
+//draws by pass, then pipeline, then mesh, with depth last so each run of
+//equal state draws front to back. translucent passes pass 1 - depth to get
+//back to front. materials are picked by DrawData::materialIndex, which is
+//pushed per draw anyway, so grouping by material would save nothing
+static const uint32_t SORT_PASS_BITS = 4;
+static const uint32_t SORT_PIPELINE_BITS = 12;
+static const uint32_t SORT_MESH_BITS = 16;
+static const uint32_t SORT_DEPTH_BITS = 16;
+
+//what the radix sort moves around, the command itself stays put
+struct DrawPacket{
+    uint64_t key;
+    uint32_t command;
+    uint32_t padding;
+};
+
+//collects a frame's draws with their sort keys, radix sorts them and
+//replays them into a command buffer, binding only what changed between
+//neighbours. key bytes no draw differs in are skipped, found with an sse2
+//and/or scan where available. histograms and scatter are scalar, large
+//queues split them across the thread pool, so sort() must not be called
+//from a pool job or it can wait on chunks queued behind itself
+class DrawQueue{
+    private:
+        std::vector<DrawCommand> commands;
+        std::vector<DrawPacket> packets;
+        std::vector<DrawPacket> scratch;
+        std::vector<uint32_t> counts;
+        ThreadPool * threadPool = nullptr;
+
+        uint32_t sortPasses = 0;
+        uint32_t changesIssued = 0;
+        uint32_t changesSaved = 0;
+
+        uint64_t varyingBits();
+        void radixPass(uint32_t shift);
+        void forEachChunk(uint32_t chunkCount, const std::function<void(uint32_t, size_t, size_t)> &);
+    public:
+        DrawQueue() = default;
+        //without a pool every sort runs on the calling thread
+        void init(ThreadPool * threadPool = nullptr);
+        static uint64_t makeKey(uint32_t pass, uint32_t pipeline, uint32_t mesh, float depth);
+        void submit(uint64_t key, const DrawCommand &);
+        void sort();
+        //binds through the recorder so its shadow state stays true for
+        //whatever is recorded after
+        void replay(CommandRecorder &);
+        void clear();
+        size_t size(){return packets.size();}
+        uint32_t getChangesIssued(){return changesIssued;}
+        uint32_t getChangesSaved(){return changesSaved;}
+        void report();
+};
+
+//compute work recorded and submitted on the compute queue, which is its own
+//queue when the device has one. results hand over to graphics by token, wait
+//on it through the frame batcher at the stage that consumes them. buffers
+//touched by both queues are created with VK_SHARING_MODE_CONCURRENT, which
+//Buffer::init fills in with both families
+class AsyncCompute{
+    private:
+        std::vector<CommandAllocator> allocators;
+        std::vector<SyncToken> submitted;
+        SubmitBatcher batcher;
+        uint32_t current = 0;
+    public:
+        AsyncCompute() = default;
+        void init(Context &, uint32_t framesInFlight = 2);
+        VkCommandBuffer begin(Context &);
+        SyncToken submit(Context &, VkCommandBuffer, const SyncToken & waitFor = {}, VkPipelineStageFlags2 waitStages = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+        void destroy(Context &);
+};
+
+//what a command is about to do with an image, write covers layout changes
+//that must not be mistaken for a read
+struct ImageUse{
+    VkPipelineStageFlags2 stages;
+    VkAccessFlags2 access;
+    VkImageLayout layout;
+    bool write;
+};
+
+//remembers the layout and last accesses of every mip and layer of tracked
+//images, and whole tracked buffers. each requested use adds only the
+//barriers a hazard or layout change needs, flush coalesces everything
+//pending into as few ranges as possible and issues a single
+//vkCmdPipelineBarrier2. uses requested between two flushes form one
+//transition point and must agree on each subresource's layout
+class ResourceStateTracker{
+    private:
+        struct AccessState{
+            VkImageLayout layout;
+            VkPipelineStageFlags2 writeStages;
+            VkAccessFlags2 writeAccess;
+            VkPipelineStageFlags2 readStages;
+            VkAccessFlags2 readAccess;
+        };
+        struct PendingBarrier{
+            bool active;
+            VkPipelineStageFlags2 srcStages;
+            VkAccessFlags2 srcAccess;
+            VkPipelineStageFlags2 dstStages;
+            VkAccessFlags2 dstAccess;
+            VkImageLayout oldLayout;
+            VkImageLayout newLayout;
+        };
+        struct TrackedImage{
+            VkImageAspectFlags aspect;
+            uint32_t mipLevels;
+            uint32_t arrayLayers;
+            std::vector<AccessState> states;
+            std::vector<PendingBarrier> pending;
+            bool dirty;
+        };
+        struct TrackedBuffer{
+            AccessState state;
+            PendingBarrier pending;
+            bool dirty;
+        };
+        struct PendingRange{
+            uint32_t mip;
+            uint32_t mipCount;
+            uint32_t layer;
+            uint32_t layerCount;
+            const PendingBarrier * barrier;
+        };
+
+        std::unordered_map<VkImage, TrackedImage> images;
+        std::unordered_map<VkBuffer, TrackedBuffer> buffers;
+        std::vector<VkImage> dirtyImages;
+        std::vector<VkBuffer> dirtyBuffers;
+        std::vector<PendingRange> layerRuns;
+        std::vector<PendingRange> ranges;
+        std::vector<VkImageMemoryBarrier2> imageBarriers;
+        std::vector<VkBufferMemoryBarrier2> bufferBarriers;
+
+        uint64_t usesRequested = 0;
+        uint64_t barriersIssued = 0;
+        uint64_t batchesIssued = 0;
+
+        static bool apply(AccessState &, PendingBarrier &, const ImageUse &, bool isImage);
+        static bool samePending(const PendingBarrier &, const PendingBarrier &);
+    public:
+        ResourceStateTracker() = default;
+        void trackImage(VkImage, VkImageAspectFlags, uint32_t mipLevels, uint32_t arrayLayers, VkImageLayout layout, VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_NONE);
+        bool isTracked(VkImage);
+        void forgetImage(VkImage);
+        void forgetBuffer(VkBuffer);
+        //image reuses memory previous wrote, its contents are discarded
+        void alias(VkImage image, VkImage previous);
+        void useImage(VkImage, const VkImageSubresourceRange &, const ImageUse &);
+        void useImage(VkImage, const ImageUse &);
+        void useBuffer(VkBuffer, VkPipelineStageFlags2, VkAccessFlags2, bool write);
+        VkImageLayout getLayout(VkImage, uint32_t mip = 0, uint32_t layer = 0);
+        void flush(VkCommandBuffer);
+        void report();
+};
+
+typedef uint32_t GraphResource;
+
+//how a pass touches a resource, each maps to stages, access and layout
+enum GraphUsage{
+    GRAPH_COLOR_ATTACHMENT,
+    GRAPH_DEPTH_ATTACHMENT,
+    GRAPH_SAMPLED,
+    GRAPH_STORAGE_READ,
+    GRAPH_STORAGE_WRITE,
+    GRAPH_TRANSFER_SRC,
+    GRAPH_TRANSFER_DST,
+    GRAPH_INDIRECT,
+    GRAPH_VERTEX_INPUT
+};
+
+struct GraphImageDesc{
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+};
+
+//frame graph. passes declare what they read and write, compile culls
+//passes nothing needs and groups the rest into dependency levels. execute
+//feeds each level's accesses to a state tracker, which issues the level's
+//barriers as one batch. transient images whose levels do not overlap share
+//memory. the graph is built and compiled once, imported handles can be
+//swapped every frame
+class RenderGraph{
+    private:
+        struct Resource{
+            bool isImage;
+            bool imported;
+            bool output;
+            GraphImageDesc desc;
+            VkImage image;
+            VkImageView imageView;
+            VkBuffer buffer;
+            VkImageUsageFlags usage;
+            VkImageLayout initialLayout;
+            VkPipelineStageFlags2 initialStages;
+            VkImageLayout finalLayout;
+            int firstLevel;
+            int lastLevel;
+            int slot;
+        };
+        struct Access{
+            GraphResource resource;
+            GraphUsage usage;
+            bool write;
+        };
+        struct Pass{
+            std::string name;
+            std::function<void(VkCommandBuffer, RenderGraph &)> record;
+            VkPipelineStageFlags2 shaderStages;
+            std::vector<Access> accesses;
+            bool alive;
+            uint32_t level;
+        };
+        struct MemorySlot{
+            VkDeviceMemory memory;
+            VkDeviceSize size;
+            uint32_t memoryTypeBits;
+            std::vector<GraphResource> residents;
+        };
+
+        std::vector<Resource> resources;
+        std::vector<Pass> passes;
+        std::vector<uint32_t> order;
+        std::vector<uint32_t> levelStart;
+        std::vector<MemorySlot> slots;
+        std::vector<bool> aliased;
+        //transients destroyed since the last execute, their tracker state is
+        //dropped there before the driver can hand the handles out again
+        std::vector<VkImage> staleImages;
+        VkDeviceSize transientBytes = 0;
+        bool compiled = false;
+
+        void cull();
+        void schedule();
+        void allocateTransients(Context &);
+        GraphResource previousTenant(GraphResource);
+    public:
+        RenderGraph() = default;
+        GraphResource createImage(const GraphImageDesc &);
+        GraphResource importImage(VkImage, VkImageView, VkFormat, VkImageLayout initialLayout, VkPipelineStageFlags2 initialStages, VkImageLayout finalLayout);
+        GraphResource importBuffer(VkBuffer);
+        void setImportedImage(GraphResource, VkImage, VkImageView);
+        void setImportedBuffer(GraphResource, VkBuffer);
+        uint32_t addPass(const std::string &, std::function<void(VkCommandBuffer, RenderGraph &)>, VkPipelineStageFlags2 shaderStages = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT);
+        void read(uint32_t pass, GraphResource, GraphUsage);
+        void write(uint32_t pass, GraphResource, GraphUsage);
+        void markOutput(GraphResource);
+        void compile(Context &);
+        void execute(VkCommandBuffer, ResourceStateTracker &);
+        VkImage getImage(GraphResource resource){return resources[resource].image;}
+        VkImageView getImageView(GraphResource resource){return resources[resource].imageView;}
+        VkBuffer getBuffer(GraphResource resource){return resources[resource].buffer;}
+        void report();
+        void destroy(Context &);
+};
+
+//one vertex and one index buffer shared by every mesh, so a whole scene
+//draws with a single pair of binds. the range layout matches the mesh
+//table read by cull.comp
+struct MeshRange{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    int32_t vertexOffset;
+    uint32_t padding;
+};
+
+class GeometryArena{
+    private:
+        Buffer vertices;
+        Buffer indices;
+        Buffer meshTable;
+        uint32_t maxVertices;
+        uint32_t maxIndices;
+        uint32_t maxMeshes;
+        uint32_t vertexCount = 0;
+        uint32_t indexCount = 0;
+        std::vector<MeshRange> meshes;
+    public:
+        GeometryArena() = default;
+        void init(Context &, uint32_t maxVertices, uint32_t maxIndices, uint32_t maxMeshes);
+        //meshes are only appended, ranges in flight never move
+        uint32_t addMesh(Context &, const std::vector<Vertex> &, const std::vector<uint16_t> &);
+        const MeshRange & getMesh(uint32_t mesh){return meshes[mesh];}
+        uint32_t getMeshCount(){return static_cast<uint32_t>(meshes.size());}
+        VkBuffer getMeshTable(){return meshTable.getBuffer();}
+        void bind(CommandRecorder &);
+        void destroy(Context &);
+};
+
+//std430 layout shared with cull.comp and indirect.vert. bounds is a
+//sphere in model space, xyz center and w radius
+struct GpuObject{
+    glm::mat4 model;
+    glm::vec4 bounds;
+    uint32_t meshIndex;
+    uint32_t materialIndex;
+    uint32_t padding[2];
+};
+
+struct CullConstants{
+    glm::vec4 planes[6];
+    uint32_t objectCount;
+    uint32_t padding[3];
+};
+
+//objects and their bounds live in storage buffers. cull() runs a compute
+//pass outside the render pass that tests every object against the frustum
+//and compacts the survivors into indirect commands, draw() issues them all
+//with one vkCmdDrawIndexedIndirectCount. the cpu records the same handful
+//of commands whatever the object count. the command id reaches the vertex
+//shader as firstInstance. objects are written in place, update them only
+//once no frame in flight reads them
+class IndirectRenderer{
+    private:
+        GeometryArena * arena;
+        uint32_t maxObjects;
+        uint32_t objectCount = 0;
+        bool indirectCountSupported;
+
+        Buffer objects;
+        Buffer commands;
+        Buffer count;
+
+        DescriptorLayout setLayout;
+        DescriptorCache descriptors;
+        VkDescriptorSet set;
+
+        VkPipelineLayout cullLayout;
+        VkPipeline cullPipeline;
+        VkPipelineLayout drawLayout;
+        VkPipeline drawPipeline;
+
+        static void extractFrustum(const glm::mat4 &, glm::vec4 planes[6]);
+    public:
+        IndirectRenderer() = default;
+        void init(Context &, GeometryArena &, RenderPass &, Display &, uint32_t maxObjects, const std::string & cullShader, const std::string & vertexShader, const std::string & fragmentShader);
+        void setObjects(Context &, const std::vector<GpuObject> &);
+        uint32_t getObjectCount(){return objectCount;}
+        //record before the render pass begins
+        void cull(CommandRecorder &, ResourceStateTracker &, const glm::mat4 & viewProjection);
+        //record inside the render pass
+        void draw(CommandRecorder &, const glm::mat4 & viewProjection);
+        void destroy(Context &);
+};
+
+//writes rgba pixels as a qoi or png file image. without alpha the fourth
+//channel is dropped, png output is stored deflate so encoding costs little
+//more than a copy
+void encodeQOI(const unsigned char * rgba, uint32_t width, uint32_t height, bool withAlpha, std::vector<unsigned char> & file);
+void encodePNG(const unsigned char * rgba, uint32_t width, uint32_t height, bool withAlpha, std::vector<unsigned char> & file);
+//encodes a fixed image in both formats, with and without alpha, and decodes
+//it back. FrameCapture::init runs it once
+bool checkCaptureEncoders();
+
+enum CaptureFormat{
+    CAPTURE_QOI,
+    CAPTURE_PNG
+};
+
+//copies presented frames into a ring of host visible buffers and hands them
+//to the thread pool for encoding once the frame's token has completed,
+//several frames later. nothing waits on the gpu: a frame that finds its
+//slot still in flight or encoding is dropped and counted instead, size the
+//ring to frames in flight plus encoder threads to capture every frame
+class FrameCapture{
+    private:
+        enum SlotState{
+            SLOT_FREE,
+            SLOT_RECORDED,
+            SLOT_IN_FLIGHT,
+            SLOT_ENCODING
+        };
+        struct Slot{
+            Buffer buffer;
+            const unsigned char * mapped;
+            VkDeviceSize capacity = 0;
+            VkExtent2D extent;
+            SyncToken token;
+            uint64_t frameNumber;
+            SlotState state = SLOT_FREE;
+        };
+        std::vector<Slot> slots;
+        uint32_t next = 0;
+        ThreadPool * encoders;
+        std::string directory;
+        CaptureFormat format;
+        VkMemoryPropertyFlags memoryProperties;
+
+        //state moves from encoding back to free on the encoder threads
+        std::mutex slotMutex;
+        std::condition_variable slotEncoded;
+
+        uint64_t captured = 0;
+        uint64_t dropped = 0;
+        uint64_t written = 0;
+        uint64_t failed = 0;
+        double encodeTotal = 0.0;
+
+        void encode(Slot &);
+    public:
+        FrameCapture() = default;
+        void init(Context &, ThreadPool &, uint32_t slotCount, const std::string & directory, CaptureFormat format = CAPTURE_QOI);
+        //record after endRenderPass(true) on a pass initialised with
+        //readback set, before the frame is submitted.
+        //false when the frame was dropped or the image cannot be read
+        bool capture(Context &, VkCommandBuffer, Display &, uint32_t imageIndex, VkImageLayout layout, uint64_t frameNumber);
+        //the token of the submit that carried the last capture
+        void submitted(const SyncToken &);
+        //hands every copy the gpu has finished to the encoders
+        void collect(Context &);
+        //waits for everything captured so far to reach disk
+        void flush(Context &);
+        void report();
+        void destroy(Context &);
+};
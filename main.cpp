@@ -3,9 +3,45 @@
 
 #define WIDTH 1000
 #define HEIGHT 1000
+#define FRAMES_IN_FLIGHT 2
 float clearColor[4] = {0.0f,0.0f,0.0f,0.0f};
 
-int main(){
+int main(int argc, char ** argv){
+    //--headless renders offscreen without sdl and stops after --frames,
+    //for ci and the render farm. --shaders points at the compiled spir-v.
+    //--capture writes every frame into a directory, qoi unless --png
+    bool headless = false;
+    uint64_t frameLimit = 0;
+    //the cmake build compiles the shaders and passes their directory in
+#ifdef SHADER_DIR
+    std::string shaderDir = SHADER_DIR;
+#else
+    std::string shaderDir = "C:\\Vulkan\\shaders\\";
+#endif
+    std::string captureDir;
+    CaptureFormat captureFormat = CAPTURE_QOI;
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if(arg == "--headless"){
+            headless = true;
+        }
+        else if(arg == "--frames" && i + 1 < argc){
+            frameLimit = std::stoull(argv[++i]);
+        }
+        else if(arg == "--shaders" && i + 1 < argc){
+            shaderDir = argv[++i];
+        }
+        else if(arg == "--capture" && i + 1 < argc){
+            captureDir = argv[++i];
+        }
+        else if(arg == "--png"){
+            captureFormat = CAPTURE_PNG;
+        }
+    }
+    if(headless && frameLimit == 0){
+        frameLimit = 300;
+    }
+
     std::vector<Vertex> vertices = { 
         {{0.0f, 0.0f}, {1.0f, 0.0f, 0.0f}}, 
         {{-0.25f, 0.5f}, {1.0f, 0.0f, 0.0f}}, 
@@ -24,45 +60,54 @@ int main(){
     };
     
     Context context;
+    context.headless = headless;
     context.initContext();
 
     Display display;
-    display.initDisplay(context, WIDTH, HEIGHT);
+    if(headless){
+        display.initHeadless(context, WIDTH, HEIGHT);
+    }
+    else{
+        display.initDisplay(context, WIDTH, HEIGHT);
+    }
 
-    CommandBuffer commandBuffer;
-    commandBuffer.initCommandBuffer(context);
+    FrameRing frameRing;
+    frameRing.init(context, display, FRAMES_IN_FLIGHT);
 
     std::vector<Image> images;
     images = display.getImagesAndViews(context);
 
     RenderPass renderPass;
-    renderPass.setRenderArea(WIDTH, HEIGHT);
+    renderPass.setRenderArea(display.swapchainExtent.width, display.swapchainExtent.height);
     renderPass.setClearColor(clearColor);
-    renderPass.initRenderPass(context, commandBuffer);
+    //offscreen images are never presented
+    if(display.offscreen){
+        renderPass.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    }
+    renderPass.readback = !captureDir.empty();
+    renderPass.initRenderPass(context, frameRing.getCurrent().commandBuffer);
     renderPass.createFramebuffers(context, images, display.swapchainExtent);
 
-    PipelineBuilder pipelineBuilder;
-    pipelineBuilder.setShader(context, VK_SHADER_STAGE_VERTEX_BIT, "C:\\Vulkan\\shaders\\vert.spv", "main");
-    pipelineBuilder.setShader(context, VK_SHADER_STAGE_FRAGMENT_BIT, "C:\\Vulkan\\shaders\\frag.spv", "main");
-    pipelineBuilder.setInputAssembly(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-    pipelineBuilder.setVertexInputState();
-    pipelineBuilder.setTessellationState();
-    pipelineBuilder.setViewportState(display.viewport, display.defaultScissor);
-    pipelineBuilder.setRasterizationState(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE, 1.0f);
-    pipelineBuilder.setMultisampleState();
-    pipelineBuilder.setColorblendState();
-    pipelineBuilder.setPipelineLayout(context);
-
-    VkPipeline graphicsPipeline = pipelineBuilder.createPipeline(context, renderPass);
-
-    Semaphore imageAvailableSem;
-    imageAvailableSem.initSemaphore(context);
+    ThreadPool threadPool;
+    threadPool.init(std::thread::hardware_concurrency());
+
+    PipelineKey trianglePipeline = {
+        shaderDir + "vert.spv",
+        shaderDir + "frag.spv",
+        VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+        VK_POLYGON_MODE_FILL,
+        VK_CULL_MODE_NONE,
+        VK_FRONT_FACE_CLOCKWISE,
+        1.0f
+    };
 
-    Semaphore renderFinishedSem;
-    renderFinishedSem.initSemaphore(context);
+    //compile everything last session used before the first frame
+    PipelineLibrary pipelineLibrary;
+    pipelineLibrary.init(context, renderPass, display, "pipelines.manifest");
+    pipelineLibrary.warmup(context, threadPool);
 
-    Fence inFlight;
-    inFlight.initFence(context, true);
+    //anything the manifest missed compiles in the background from here on
+    pipelineLibrary.enableAsyncCompilation(threadPool);
 
     VertexBuffer vBuffer;
     vBuffer.init(context, vertices);
@@ -70,28 +115,83 @@ int main(){
     IndexBuffer iBuffer;
     iBuffer.init(context, indices);
     
+    DrawData hexagon = {};
+    hexagon.model = glm::mat4(1.0f);
+    hexagon.materialIndex = 0;
+
+    //the scene never changes, so it is recorded once and replayed. dynamic
+    //draws would go through a ParallelRecorder executed after the bundle
+    StaticBundle sceneBundle;
+    sceneBundle.init(context, renderPass);
+
+    //one slot per frame in flight plus one per encoder keeps up without
+    //dropping as long as encoding keeps pace with rendering
+    bool capturing = !captureDir.empty();
+    FrameCapture frameCapture;
+    if(capturing){
+        frameCapture.init(context, threadPool, frameRing.getDepth() + threadPool.getThreadCount(), captureDir, captureFormat);
+    }
+    VkPipeline bundledPipeline = VK_NULL_HANDLE;
+
     bool running = true;
-    uint32_t imageIndex = 0;
 
     while(running) {
         SDL_Event windowEvent;
-        while(SDL_PollEvent(&windowEvent))
+        while(!headless && SDL_PollEvent(&windowEvent))
             if(windowEvent.type == SDL_EVENT_QUIT) {
                 running = false;
                 break;
             }
-            inFlight.wait(context);
-            inFlight.reset(context);
-            imageIndex = display.getNextPresentableSwapchainIndex(context, display, imageAvailableSem);
-            renderPass.startRenderPass(graphicsPipeline, imageIndex);
-                vBuffer.bind(commandBuffer);
-                iBuffer.bind(commandBuffer);
-                renderPass.drawIndexed(indices.size());
-            renderPass.endRenderPass();
-
-            renderPass.submitWork(context, imageAvailableSem, renderFinishedSem, inFlight);
-            renderPass.submitPresentation(context, display, renderFinishedSem, imageIndex);
+            if(frameLimit != 0 && frameRing.getFrameNumber() >= frameLimit){
+                break;
+            }
+            FrameContext & frame = frameRing.beginFrame(context, display, renderPass);
+            pipelineLibrary.beginFrame();
+            VkPipeline graphicsPipeline = pipelineLibrary.getPipeline(context, trianglePipeline);
+            //only re-recorded when the async compile hands over a new pipeline
+            if(graphicsPipeline != bundledPipeline){
+                sceneBundle.setDraws({{
+                    graphicsPipeline,
+                    pipelineLibrary.getPipelineLayout(),
+                    vBuffer.getBuffer(),
+                    iBuffer.getBuffer(),
+                    static_cast<uint32_t>(indices.size()),
+                    0,
+                    0,
+                    hexagon
+                }});
+                bundledPipeline = graphicsPipeline;
+            }
+            renderPass.startRenderPass(frame.imageIndex, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+            renderPass.executeCommands({sceneBundle.get(context, frameRing, renderPass, frame.imageIndex)});
+            renderPass.endRenderPass(capturing);
+            if(capturing){
+                if(frame.acquired){
+                    frameCapture.capture(context, frame.commandBuffer.buffer, display, frame.imageIndex, renderPass.finalLayout, frameRing.getFrameNumber());
+                }
+                renderPass.finishRecording();
+            }
+
+            frameRing.endFrame(context, display, renderPass);
+            if(capturing){
+                frameCapture.submitted(frame.submitted);
+            }
+    }
+
+    if(capturing){
+        frameCapture.flush(context);
+        frameCapture.report();
+        frameCapture.destroy(context);
     }
+    threadPool.waitIdle();
+    vkDeviceWaitIdle(context.device);
+    sceneBundle.destroy(context);
+    frameRing.destroy(context);
+    pipelineLibrary.saveManifest(context);
+    pipelineLibrary.report();
+    pipelineLibrary.destroy(context);
+    display.report();
+    display.destroy(context);
     
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,12 @@
+//include in shaders that read from BindlessTable, bound at set 0
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(set = 0, binding = 0) readonly buffer BindlessBuffer {
+    uint words[];
+} bindlessBuffers[];
+
+layout(set = 0, binding = 1) uniform sampler2D bindlessImages[];
+
+vec4 sampleBindless(uint handle, vec2 uv) {
+    return texture(bindlessImages[nonuniformEXT(handle)], uv);
+}
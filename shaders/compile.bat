@@ -1,3 +1,6 @@
 C:\VulkanSDK\1.3.290.0\Bin\glslc.exe shader.vert -o vert.spv
 C:\VulkanSDK\1.3.290.0\Bin\glslc.exe shader.frag -o frag.spv
+C:\VulkanSDK\1.3.290.0\Bin\glslc.exe cull.comp -o cull.spv
+C:\VulkanSDK\1.3.290.0\Bin\glslc.exe indirect.vert -o indirect.spv
+C:\VulkanSDK\1.3.290.0\Bin\glslc.exe instanced.vert -o instanced.spv
 pause
\ No newline at end of file
@@ -0,0 +1,25 @@
+#version 450
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+struct Object {
+    mat4 model;
+    vec4 bounds;
+    uint meshIndex;
+    uint materialIndex;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Objects { Object objects[]; };
+
+layout(push_constant) uniform View {
+    mat4 viewProjection;
+} view;
+
+layout(location = 0) out vec3 fragColor;
+
+void main() {
+    //the cull pass stores the object id in firstInstance
+    gl_Position = view.viewProjection * objects[gl_InstanceIndex].model * vec4(inPosition, 0.0, 1.0);
+    fragColor = inColor;
+}
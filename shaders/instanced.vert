@@ -0,0 +1,20 @@
+#version 450
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+layout(location = 2) in mat4 instanceTransform;
+layout(location = 6) in vec4 instanceColor;
+layout(location = 7) in vec4 instanceCustom;
+
+layout(push_constant) uniform DrawData {
+    mat4 model;
+    uint materialIndex;
+} draw;
+
+layout(location = 0) out vec3 fragColor;
+
+void main() {
+    gl_Position = draw.model * instanceTransform * vec4(inPosition, 0.0, 1.0);
+    fragColor = inColor * instanceColor.rgb;
+}
@@ -3,9 +3,14 @@
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColor;
 
+layout(push_constant) uniform DrawData {
+    mat4 model;
+    uint materialIndex;
+} draw;
+
 layout(location = 0) out vec3 fragColor;
 
 void main() {
-    gl_Position = vec4(inPosition, 0.0, 1.0);
+    gl_Position = draw.model * vec4(inPosition, 0.0, 1.0);
     fragColor = inColor;
-}
\ No newline at end of file
+}